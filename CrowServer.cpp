@@ -84,13 +84,8 @@ int main()
             message = body.substr(start, end - start);
         }
 
-        // Encode using the Image class
-        Image *image = new Image(filename);
-
-        image->generateBitmap();
-        image->encodeLSB("stego_" + filename, message);
-
-        delete image;
+        // Encode in a single pixel buffer, without loading an Image
+        Image::embedLSBMessage(filename, "stego_" + filename, message);
 
         // Read the file back to return it
         ifstream file("./stego_" + filename, ios::binary | ios::ate);
@@ -125,19 +120,8 @@ int main()
         size_t end = body.find("\r\n--", start);
         string file_content = body.substr(start, end - start);
 
-        // set filename to temp_(randomNumber).png
-        string filename = "temp_decode_" + to_string(rand()) + ".png";
-
-        save_file(filename, file_content);
-
-        // Encode using the Image class
-        Image *image = new Image(filename);
-
-        image->generateBitmap();
-
-        string decoded_message = image->decodeLSB();
-
-        delete image;
+        // Decode straight from the uploaded bytes, reading rows only up to the message's terminator
+        string decoded_message = Image::extractLSBMessageFromMemory(reinterpret_cast<const unsigned char*>(file_content.data()), file_content.size());
 
         res.code = 200;
         res.set_header("Content-Type", "text/plain");
@@ -226,38 +210,26 @@ int main()
         size_t end = body.find("\r\n--", start);
         string file_content = body.substr(start, end - start);
 
-        // set filename to temp_(randomNumber).png
-        string filename = "temp_" + to_string(rand()) + ".png";
-
-        save_file(filename, file_content);
+        // Previews ask for a reduced size (?scale=2, 4 or 8), decoded through reduced inverse DCTs
+        int scale = 1;
+        if (const char* scaleParam = req.url_params.get("scale")) {
+            scale = atoi(scaleParam);
+        }
 
-        // Encode using the Jpeg class
+        // Decode using the Jpeg class and encode the PNG, both in memory
         JpegImage *image = new JpegImage();
 
-        image->decodeJpeg(filename);
-
-        string new_filename = "png_" + filename.substr(0, filename.size() - 4) + ".png";
-        image->savePng(new_filename);
+        image->decodeJpegScaledFromMemory(reinterpret_cast<const unsigned char*>(file_content.data()), file_content.size(), scale);
+        vector<unsigned char> png = image->savePngToMemory();
 
         delete image;
 
-
-        // Read the file back to return it
-        ifstream file("./" + new_filename, ios::binary | ios::ate);
-        if (file) {
-            streamsize size = file.tellg();
-            file.seekg(0, ios::beg);
-            vector<char> buffer(size);
-            if (file.read(buffer.data(), size)) {
-                res.set_header("Content-Type", "image/png");
-                res.set_header("Content-Disposition", "attachment; filename=\"" + filename + "\"");
-                res.write(string(buffer.begin(), buffer.end()));
-                res.end();
-            } else {
-                res.code = 500;
-                res.write("Failed to read the file");
-                res.end();
-            }
+        if (!png.empty()) {
+            string filename = "temp_" + to_string(rand()) + ".png";
+            res.set_header("Content-Type", "image/png");
+            res.set_header("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+            res.write(string(png.begin(), png.end()));
+            res.end();
         } else {
             res.code = 500;
             res.write("Failed to process the file");
@@ -280,11 +252,9 @@ int main()
 
         save_file(filename, file_content);
 
-        // Encode using the Image class
+        // Extract the message block by block, stopping at its terminator
         JpegImage *image = new JpegImage();
-        image->decodeJpeg(filename);
-
-        string decoded_message = image->decodeLSBOnQuantizedBlocks();
+        string decoded_message = image->extractLSBMessage(filename);
 
         res.code = 200;
         res.set_header("Content-Type", "text/plain");
@@ -509,11 +479,11 @@ string steganalysis_jpeg(string filename) {
     vector<VectorXd> data;
 
     auto *image = new JpegImage();
-    image->decodeJpeg(filename);
+    image->decodeJpeg(filename, DecodeUntil::DctCoefficients);
 
     // Split image into blocks of 4 * 4 DCT coefficients
-    for (int y = 0; y <= image->dctBlocks.size() - 4; y += 4) {
-        for (int x = 0; x <= image->dctBlocks[y].size() - 4; x += 4) {
+    for (int y = 0; y <= image->dctBlocks.rows() - 4; y += 4) {
+        for (int x = 0; x <= image->dctBlocks.cols() - 4; x += 4) {
             // Input vector
             VectorXd input = VectorXd::Zero(INPUT_JPEG_SIZE);
             VectorXd processedInput = VectorXd::Zero(PROCESSED_JPEG_INPUT);
@@ -521,12 +491,12 @@ string steganalysis_jpeg(string filename) {
             int i = 0;
             for (int j = y; j < y + 4; j++) {
                 for (int k = x; k < x + 4; k++) {
-                    DCTBlock *block = image->dctBlocks[j][k];
+                    DCTBlock block = image->dctBlocks.block(j, k);
                     for (int l = 0; l < 8; l++) {
                         for (int n = 0; n < 8; n++) {
-                            input(i++) = block->Y[l][n];
-                            input(i++) = block->Cb[l][n];
-                            input(i++) = block->Cr[l][n];
+                            input(i++) = block.Y[l * 8 + n];
+                            input(i++) = block.Cb[l * 8 + n];
+                            input(i++) = block.Cr[l * 8 + n];
                         }
                     }
                 }
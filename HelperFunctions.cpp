@@ -55,4 +55,50 @@ void saveStringToFile(string filename, string contents) {
 
     outputFile << contents;
     outputFile.close();
+}
+
+// copyFromCImg()
+// Description: Copies the top-left width x height pixels of a CImg image into an interleaved RGB
+//              buffer, a row of each plane at a time
+// Parameters: const CImg<unsigned char> &image - the source image
+//             PixelBuffer<color> &pixels - the buffer to fill (allocated here)
+//             int width, int height - the size to copy
+void copyFromCImg(const CImg<unsigned char> &image, PixelBuffer<color> &pixels, int width, int height) {
+    pixels.allocate(width, height);
+
+    const int lastChannel = max(0, image.spectrum() - 1);
+    for (int y = 0; y < height; y++) {
+        const unsigned char *r = image.data(0, y, 0, min(0, lastChannel));
+        const unsigned char *g = image.data(0, y, 0, min(1, lastChannel));
+        const unsigned char *b = image.data(0, y, 0, min(2, lastChannel));
+        color *row = pixels[y];
+
+        for (int x = 0; x < width; x++) {
+            row[x].r = r[x];
+            row[x].g = g[x];
+            row[x].b = b[x];
+        }
+    }
+}
+
+// copyToCImg()
+// Description: Copies an interleaved RGB buffer into a 3 channel CImg image, a row of each plane at
+//              a time
+// Parameters: const PixelBuffer<color> &pixels - the source buffer
+//             CImg<unsigned char> &image - the image to fill (resized to the buffer)
+void copyToCImg(const PixelBuffer<color> &pixels, CImg<unsigned char> &image) {
+    image.assign(pixels.width(), pixels.height(), 1, 3);
+
+    for (int y = 0; y < pixels.height(); y++) {
+        const color *row = pixels[y];
+        unsigned char *r = image.data(0, y, 0, 0);
+        unsigned char *g = image.data(0, y, 0, 1);
+        unsigned char *b = image.data(0, y, 0, 2);
+
+        for (int x = 0; x < pixels.width(); x++) {
+            r[x] = row[x].r;
+            g[x] = row[x].g;
+            b[x] = row[x].b;
+        }
+    }
 }
\ No newline at end of file
@@ -1,4 +1,10 @@
 #include "StegoLib.h"
+#include "PngCodec.h"
+#include "StegoLsb.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
 #include <string>
 #include <iostream>
 
@@ -7,176 +13,127 @@ using namespace cimg_library;
 
 
 void Image::generateBitmap() {
+	if (!image) {
+		return;
+	}
+
 	width = image->width();
 	height = image->height();
 
-	// Defining size of the pixels 2D vector
-	pixels.resize(height);
-	for (int i = 0; i < height; i++) {
-		pixels[i].resize(width);
-	}
-	
-	cimg_forXY(*image, x, y) {
-		// Access pixel values at (x, y)
-		unsigned char pixelValue = (*image)(x, y, 0, 0);
-
-		// Adding pixel data to the pixels 2D vector
-		pixels[y][x].r = (*image)(x, y, 0, 0);
-		pixels[y][x].g = (*image)(x, y, 0, 1);
-		pixels[y][x].b = (*image)(x, y, 0, 2);
+	// Copying the pixel data into the pixel buffer, which holds the only copy of the image from now on
+	copyFromCImg(*image, pixels, width, height);
+	delete image;
+	image = nullptr;
+}
+
+// savePixels()
+// Description: Saves an image straight from its pixel buffer: PNG files through the in-process
+//              encoder, other formats through a CImg copy
+// Output: bool - false if the file cannot be written
+static bool savePixels(const PixelBuffer<color> &pixels, const string &outputFilename) {
+	string extension = filesystem::path(outputFilename).extension().string();
+	transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+	if (extension == ".png") {
+		return writePngFile(outputFilename, pixels);
 	}
+
+	CImg<unsigned char> image;
+	copyToCImg(pixels, image);
+	image.save(outputFilename.c_str());
+	return true;
 }
 
 void Image::encodeLSB(string outputFilename, string message) {
-	int bitCount = 0;
-	int terminatorCount = 8;
-	int bitLength = message.length() * sizeof(unsigned char) * 8;
-	enum encoding_status status = encoding_status::MESSAGE;
-	bool bit;
-	unsigned char onMask = 0x01;
-	unsigned char offMask = 0xFE;
-
-	// Creating new image
-	CImg<unsigned char> encoded_image(width, height, 1, 3);
-
-	// Checking if image is large enough to hold the message.txt
-	if (bitCount + 8 > width * height * 3) {
+	// Checking if image is large enough to hold the message and its terminator
+	const uint64_t bitCount = ((uint64_t)message.length() + 1) * 8;
+	if (bitCount > lsbCapacity(width, height)) {
 		cout << "Message is too large to encode in this image." << endl;
         return;
 	}
 
-	// Initiate array with three elements
-	unsigned char color[3];
-
-	// Iterating over all pixels in the image and encoding message.txt
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			color[0] = pixels[y][x].r;
-			color[1] = pixels[y][x].g;
-			color[2] = pixels[y][x].b;
-
-			// Modifying the least significant bit of each color channel
-			switch (status) {
-			case encoding_status::MESSAGE:
-				for (int i = 0; i < 3; i++) {
-					if (bitCount == bitLength || status == encoding_status::TERMINATOR) {
-						status = encoding_status::TERMINATOR;
-						color[i] &= offMask;
-						terminatorCount--;
-					}
-					else {
-						bit = getBit(message[bitCount / 8], 7 - bitCount % 8);
-
-						if (bit) {
-							color[i] |= onMask;
-						}
-						else {
-							color[i] &= offMask;
-						}
-
-						bitCount++;
-					}
-				}
-				break;
-			case encoding_status::TERMINATOR:
-				if (terminatorCount > 0) {
-					for (int i = 0; i < 3; i++) {
-						if (terminatorCount == 0) {
-							status = encoding_status::DONE;
-							break;
-						}
-
-						color[i] &= offMask;
-						terminatorCount--;
-					}
-				}
-				break;
-			default:
-				break;
-			}
-
-			encoded_image.draw_point(x, y, color);
+	// Embedding in place: only the rows the payload covers are kept aside, and put back once the
+	// encoded image is saved
+	const size_t rowChannels = (size_t)width * 3;
+	const int rows = (int)((bitCount + rowChannels - 1) / rowChannels);
+	vector<color> covered((size_t)rows * width);
+	for (int y = 0; y < rows; ++y) {
+		memcpy(&covered[(size_t)y * width], pixels[y], width * sizeof(color));
+	}
+
+	auto restoreCovered = [&]() {
+		for (int y = 0; y < rows; ++y) {
+			memcpy(pixels[y], &covered[(size_t)y * width], width * sizeof(color));
 		}
+	};
+
+	embedLsbMessage(pixels, message);
 
+	// Saving encoded image (CImg throws on failure for non-PNG formats, the pixels are restored first)
+	try {
+		if (!savePixels(pixels, outputFilename)) {
+			cout << "Failed to write " << outputFilename << " - Image::encodeLSB" << endl;
+		}
+	}
+	catch (...) {
+		restoreCovered();
+		throw;
 	}
 
-	// Displaying both images
-	CImgList<unsigned char> list(2);
+	restoreCovered();
+}
 
-	list.insert(*image, 0).insert(encoded_image, 1);
+bool Image::embedLSBMessage(const string &inputPath, const string &outputFilename, const string &message) {
+	// Decoding the PNG straight into the buffer the message is embedded in, other formats go
+	// through CImg
+	PixelBuffer<color> pixels;
+	if (!readPngFile(inputPath, pixels)) {
+		CImg<unsigned char> image(inputPath.c_str());
+		copyFromCImg(image, pixels, image.width(), image.height());
+	}
 
-	// Displaying CImgList
-//	CImgDisplay main_disp(list, "Original vs Encoded Image");
-//
-//	main_disp.resize(width, height / 2);
-//	main_disp.move(100, 100);
-//
-//	// Wait for the user to close the display window
-//	while (!main_disp.is_closed()) {
-//		main_disp.wait();
-//	}
+	if (!embedLsbMessage(pixels, message)) {
+		cout << "Message is too large to encode in this image." << endl;
+		return false;
+	}
 
-	// Saving encoded image
-	encoded_image.save(outputFilename.c_str());
+	if (!savePixels(pixels, outputFilename)) {
+		cout << "Failed to write " << outputFilename << " - Image::embedLSBMessage" << endl;
+		return false;
+	}
+	return true;
 }
 
 string Image::decodeLSB() {
-    bool done = false;
-    int bitCount = 0;
-
-    string message = "";
-
-    // Write one character at a time
-    unsigned char character = 0;
-    unsigned char color[3] = { 0, 0, 0 };
-
-    // print new line
-    cout << endl << endl;
-
-    // Iterating over all pixels in the image and decoding message.txt
-    for (int y = 0; y < height && !done; ++y) {
-        for (int x = 0; x < width && !done; ++x) {
-            color[0] = pixels[y][x].r;
-            color[1] = pixels[y][x].g;
-            color[2] = pixels[y][x].b;
-
-            for (int i = 0; i < 3; i++) {
-                if (!done) {
-                    // Read the next bit from the image
-                    bool bit = color[i] & 0x01;
-
-                    // Write the bit to the file
-                    character = (character << 1) | bit;
-
-                    // Increment the bit count
-                    bitCount++;
-
-                    // Check if we have read 8 bits
-                    if (bitCount % 8 == 0) {
-                        // Check for the terminator
-                        if (character == 0) {
-                            done = true;
-                        } else {
-                            cout << character;
-
-                            // Write the character to the file
-                            message.append(1, character);
-
-                            character = 0;
-                        }
-                    }
-                }
-            }
-        }
-    }
+    // Reading whole rows, the message grows a row at a time up to the terminator
+    PixelLsbReader reader;
+
+    for (unsigned int y = 0; y < height && reader.readPixels(pixels[y], width); ++y) {}
 
-    return message;
+    return reader.message();
 }
 
-void Image::decodeLSB(string outputFilename) {
-	bool done = false;
-	int bitCount = 0;
+string Image::extractLSBMessage(const string &path) {
+	PixelLsbReader reader;
+	if (!streamPngFile(path, [&reader](const color *row, int width) { return reader.readPixels(row, width); })) {
+		cout << "Failed to read " << path << " - Image::extractLSBMessage" << endl;
+		return "";
+	}
 
+	return reader.message();
+}
+
+string Image::extractLSBMessageFromMemory(const unsigned char *data, size_t size) {
+	PixelLsbReader reader;
+	if (!streamPng(data, size, [&reader](const color *row, int width) { return reader.readPixels(row, width); })) {
+		cout << "Invalid PNG data - Image::extractLSBMessageFromMemory" << endl;
+		return "";
+	}
+
+	return reader.message();
+}
+
+void Image::decodeLSB(string outputFilename) {
 	// Open a new text file for writing
 	std::ofstream outputFile(outputFilename);
 
@@ -185,49 +142,9 @@ void Image::decodeLSB(string outputFilename) {
 		return;
 	}
 
-	// Write one character at a time
-	unsigned char character = 0;
-	unsigned char color[3] = { 0, 0, 0 };
-
-	// print new line
-	cout << endl << endl;
-
-	// Iterating over all pixels in the image and decoding message.txt
-	for (int y = 0; y < height && !done; ++y) {
-		for (int x = 0; x < width && !done; ++x) {
-			color[0] = pixels[y][x].r;
-			color[1] = pixels[y][x].g;
-			color[2] = pixels[y][x].b;
-			
-			for (int i = 0; i < 3; i++) {
-                if (!done) {
-                    // Read the next bit from the image
-                    bool bit = color[i] & 0x01;
-
-                    // Write the bit to the file
-                    character = (character << 1) | bit;
-
-                    // Increment the bit count
-                    bitCount++;
-
-                    // Check if we have read 8 bits
-                    if (bitCount % 8 == 0) {
-                        // Check for the terminator
-                        if (character == 0) {
-                            done = true;
-                        } else {
-                            cout << character;
-
-                            // Write the character to the file
-                            outputFile.put(character);
-
-                            character = 0;
-                        }
-                    }
-                }
-			}
-		}
-	}
+	// Writing the message in one go
+	const string message = decodeLSB();
+	outputFile.write(message.data(), message.size());
 
 	// Close the file
 	outputFile.close();
@@ -235,7 +152,13 @@ void Image::decodeLSB(string outputFilename) {
 
 void Image::displayImage() {
 	cout << "Displaying image..." << endl;
-	CImgDisplay display(*image, "Loaded Image");
+
+	// After generateBitmap() the image only lives in the pixel buffer
+	CImg<unsigned char> fromPixels;
+	if (!image) {
+		copyToCImg(pixels, fromPixels);
+	}
+	CImgDisplay display(image ? *image : fromPixels, "Loaded Image");
 
 	// Move the display window and set display size
 	display.move(100, 100);
@@ -260,13 +183,18 @@ void Image::save_resize(const string &outputFilename, int factor) {
 
 void Image::printBitmap() {
 	// Print 2d vector of pixel data
-	for (int i = 0; i < pixels.size(); i++) {
-		for (int j = 0; j < pixels[i].size(); j++) {
+	for (int i = 0; i < pixels.height(); i++) {
+		for (int j = 0; j < pixels.width(); j++) {
 			cout << "Pixel at (" << i << ", " << j << "): " << static_cast<int>(pixels[i][j].r) << ", " << static_cast<int>(pixels[i][j].g) << ", " << static_cast<int>(pixels[i][j].b) << endl;
 		}
 	}
 }
 
 void Image::save(const string &outputFilename) {
-    image->save(outputFilename.c_str());
+    if (image) {
+        image->save(outputFilename.c_str());
+    }
+    else if (!savePixels(pixels, outputFilename)) {
+        cout << "Failed to write " << outputFilename << " - Image::save" << endl;
+    }
 }
\ No newline at end of file
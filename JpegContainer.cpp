@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "JpegContainer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#    define JPEG_CONTAINER_MMAP 1
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+using namespace std;
+
+// Leading bytes of canonical files; a legacy file starts with its quality instead
+static const unsigned char containerMagic[4] = {'S', 'J', 'P', 'G'};
+
+void writeVarint(vector<unsigned char> &output, uint64_t value) {
+    while (value >= 0x80) {
+        output.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    output.push_back((unsigned char)value);
+}
+
+void writeSignedVarint(vector<unsigned char> &output, int64_t value) {
+    writeVarint(output, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+bool readVarint(const unsigned char *&data, const unsigned char *end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (data == end) return false;
+
+        const unsigned char byte = *data++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool readSignedVarint(const unsigned char *&data, const unsigned char *end, int64_t &value) {
+    uint64_t mapped;
+    if (!readVarint(data, end, mapped)) return false;
+
+    value = (int64_t)(mapped >> 1) ^ -(int64_t)(mapped & 1);
+    return true;
+}
+
+// Appends an int in the machine's byte order, as the legacy header stores them
+static void writeRawInt(vector<unsigned char> &output, int value) {
+    const unsigned char *bytes = (const unsigned char*)&value;
+    output.insert(output.end(), bytes, bytes + sizeof(int));
+}
+
+static bool readRawInt(const unsigned char *&data, const unsigned char *end, int &value) {
+    if ((size_t)(end - data) < sizeof(int)) return false;
+
+    memcpy(&value, data, sizeof(int));
+    data += sizeof(int);
+    return true;
+}
+
+// Reads an unsigned varint that has to fit in a non-negative int
+static bool readVarintInt(const unsigned char *&data, const unsigned char *end, int &value) {
+    uint64_t wide;
+    if (!readVarint(data, end, wide) || wide > INT_MAX) return false;
+
+    value = (int)wide;
+    return true;
+}
+
+// writeLegacyHeader()
+// Description: Quality, height, width, frequency table, encoded size in whole bytes and RLE size
+static void writeLegacyHeader(vector<unsigned char> &output, const JpegContainerHeader &header) {
+    writeRawInt(output, header.quality);
+    writeRawInt(output, header.height);
+    writeRawInt(output, header.width);
+
+    writeRawInt(output, (int)header.frequencies.size());
+    for (auto const& x : header.frequencies) {
+        writeRawInt(output, x.first);
+        writeRawInt(output, x.second);
+    }
+
+    writeRawInt(output, (int)(header.encodedBits / 8));
+    writeRawInt(output, header.rleSize);
+}
+
+// writeCodeLengths()
+// Description: Code lengths grouped by length - the longest length, then per length the symbol
+//              count, the first symbol and the gaps between the (ascending) symbols
+static void writeCodeLengths(vector<unsigned char> &output, const vector<HuffmanCodeLength> &codeLengths) {
+    const int maxLength = codeLengths.empty() ? 0 : codeLengths.back().length;
+    writeVarint(output, maxLength);
+
+    size_t next = 0;
+    for (int length = 1; length <= maxLength; length++) {
+        size_t end = next;
+        while (end < codeLengths.size() && codeLengths[end].length == length) end++;
+
+        writeVarint(output, end - next);
+        for (size_t i = next; i < end; i++) {
+            if (i == next) writeSignedVarint(output, codeLengths[i].symbol);
+            else writeVarint(output, (uint64_t)((int64_t)codeLengths[i].symbol - codeLengths[i - 1].symbol - 1));
+        }
+        next = end;
+    }
+}
+
+// writeCanonicalHeader()
+// Description: Magic, version, flags and varint fields, followed by the code tables - the single
+//              RLE value table in version 2, a table count and the DC/AC tables in version 3
+static void writeCanonicalHeader(vector<unsigned char> &output, const JpegContainerHeader &header) {
+    output.insert(output.end(), containerMagic, containerMagic + 4);
+    output.push_back((unsigned char)header.version);
+    output.push_back((unsigned char)header.flags);
+
+    writeVarint(output, header.quality);
+    writeVarint(output, header.height);
+    writeVarint(output, header.width);
+    writeVarint(output, header.rleSize);
+    writeVarint(output, header.encodedBits);
+
+    if (header.flags & JPEG_FLAG_SUBSAMPLING) {
+        writeVarint(output, header.hSampling);
+        writeVarint(output, header.vSampling);
+    }
+
+    if (header.version == JPEG_FORMAT_CANONICAL) {
+        writeCodeLengths(output, header.codeTables.empty() ? vector<HuffmanCodeLength>() : header.codeTables[0]);
+        return;
+    }
+
+    writeVarint(output, header.codeTables.size());
+    for (const vector<HuffmanCodeLength> &table : header.codeTables) {
+        writeCodeLengths(output, table);
+    }
+
+    // Segment index: rows per segment, segment count and the byte size of each segment
+    if (header.flags & JPEG_FLAG_RESTARTS) {
+        writeVarint(output, header.restartInterval);
+        writeVarint(output, header.segmentSizes.size());
+        for (uint64_t segmentSize : header.segmentSizes) {
+            writeVarint(output, segmentSize);
+        }
+    }
+}
+
+void writeContainerHeader(vector<unsigned char> &output, const JpegContainerHeader &header) {
+    if (header.version == JPEG_FORMAT_LEGACY) writeLegacyHeader(output, header);
+    else writeCanonicalHeader(output, header);
+}
+
+// Largest quantized coefficient magnitude of 8-bit samples
+static const int LEGACY_MAX_COEFFICIENT = 2048;
+
+// validRleSize()
+// Description: Checks the RLE sequence size against the image and the data: at most a (value, count)
+//              pair per coefficient, and at most one value per bit since every code is a bit long at least
+// Input: const JpegContainerHeader &header - header with the image fields and rleSize read
+//        uint64_t codedBits - number of bits the values are coded in
+// Output: bool - false if the encoder cannot have written the size
+static bool validRleSize(const JpegContainerHeader &header, uint64_t codedBits) {
+    const int64_t coefficients = (int64_t)max(header.width, 0) * max(header.height, 0) * 3;
+    return header.rleSize >= 0 && header.rleSize <= 2 * coefficients && (uint64_t)header.rleSize <= codedBits;
+}
+
+static bool parseLegacyHeader(const unsigned char *&data, const unsigned char *end, JpegContainerHeader &header) {
+    header.version = JPEG_FORMAT_LEGACY;
+    header.flags = 0;
+
+    int freqSize;
+    if (!readRawInt(data, end, header.quality) || !readRawInt(data, end, header.height) ||
+        !readRawInt(data, end, header.width) || !readRawInt(data, end, freqSize)) {
+        return false;
+    }
+
+    // A Huffman tree needs two symbols at least
+    if (freqSize < 2 || (size_t)freqSize > (size_t)(end - data) / (2 * sizeof(int))) return false;
+
+    // Keys are RLE values: quantized coefficients (within +-2048) and run counts (at most one run
+    // per coefficient of the image), counted at least once. Anything else cannot come from the encoder
+    const int64_t maxRun = (int64_t)max(header.width, 0) * max(header.height, 0) * 3;
+
+    header.frequencies.clear();
+    for (int i = 0; i < freqSize; i++) {
+        int key = 0, value = 0;
+        readRawInt(data, end, key);
+        readRawInt(data, end, value);
+        if (key < -LEGACY_MAX_COEFFICIENT || (key > LEGACY_MAX_COEFFICIENT && key > maxRun) || value < 1) return false;
+        header.frequencies[key] = value;
+    }
+
+    // Only whole bytes are counted - the trailing partial byte of the encoder is not part of the data
+    int encodedSize;
+    if (!readRawInt(data, end, encodedSize) || !readRawInt(data, end, header.rleSize) || encodedSize < 0) {
+        return false;
+    }
+    header.encodedBits = (uint64_t)encodedSize * 8;
+
+    // The values coded in the partial byte count towards rleSize too
+    return validRleSize(header, header.encodedBits + 7);
+}
+
+static bool parseCodeLengths(const unsigned char *&data, const unsigned char *end, vector<HuffmanCodeLength> &codeLengths) {
+    int maxLength;
+    if (!readVarintInt(data, end, maxLength) || maxLength > 63) return false;
+
+    codeLengths.clear();
+    for (int length = 1; length <= maxLength; length++) {
+        uint64_t count;
+        if (!readVarint(data, end, count) || count > (uint64_t)(end - data)) return false;
+
+        int64_t symbol = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            if (i == 0) {
+                if (!readSignedVarint(data, end, symbol)) return false;
+            } else {
+                uint64_t gap;
+                if (!readVarint(data, end, gap) || gap > (uint64_t)INT_MAX * 2) return false;
+                symbol += (int64_t)gap + 1;
+            }
+            if (symbol < INT_MIN || symbol > INT_MAX) return false;
+
+            codeLengths.push_back(HuffmanCodeLength{(int)symbol, length});
+        }
+    }
+    return true;
+}
+
+static bool parseCanonicalHeader(const unsigned char *&data, const unsigned char *end, JpegContainerHeader &header) {
+    if (end - data < 6) return false;
+
+    header.version = data[4];
+    header.flags = data[5];
+    data += 6;
+    const int knownFlags = header.version == JPEG_FORMAT_RUN_SIZE ? JPEG_FLAG_RESTARTS | JPEG_FLAG_SUBSAMPLING : 0;
+    if (header.version < JPEG_FORMAT_CANONICAL || header.version > JPEG_FORMAT_RUN_SIZE || (header.flags & ~knownFlags)) {
+        return false;
+    }
+
+    if (!readVarintInt(data, end, header.quality) || !readVarintInt(data, end, header.height) ||
+        !readVarintInt(data, end, header.width) || !readVarintInt(data, end, header.rleSize) ||
+        !readVarint(data, end, header.encodedBits) || !validRleSize(header, header.encodedBits)) {
+        return false;
+    }
+
+    // Luma blocks per MCU, 2x1 (4:2:2) or 2x2 (4:2:0) with subsampled chroma
+    header.hSampling = 1;
+    header.vSampling = 1;
+    if ((header.flags & JPEG_FLAG_SUBSAMPLING) &&
+        (!readVarintInt(data, end, header.hSampling) || !readVarintInt(data, end, header.vSampling) ||
+         header.hSampling != 2 || header.vSampling < 1 || header.vSampling > 2)) {
+        return false;
+    }
+
+    int tableCount = 1;
+    if (header.version != JPEG_FORMAT_CANONICAL && (!readVarintInt(data, end, tableCount) || tableCount > 16)) {
+        return false;
+    }
+
+    header.codeTables.assign(tableCount, vector<HuffmanCodeLength>());
+    for (vector<HuffmanCodeLength> &table : header.codeTables) {
+        if (!parseCodeLengths(data, end, table)) return false;
+    }
+
+    header.restartInterval = 0;
+    header.segmentSizes.clear();
+    if (header.flags & JPEG_FLAG_RESTARTS) {
+        // The segments have to cover the MCU rows and add up to the payload
+        const int mcuRows = (header.height / 8 + header.vSampling - 1) / header.vSampling;
+        int segmentCount;
+        if (!readVarintInt(data, end, header.restartInterval) || !readVarintInt(data, end, segmentCount) ||
+            header.restartInterval < 1 || segmentCount != (mcuRows + header.restartInterval - 1) / header.restartInterval ||
+            (size_t)segmentCount > (size_t)(end - data)) {
+            return false;
+        }
+
+        uint64_t total = 0;
+        header.segmentSizes.resize(segmentCount);
+        for (uint64_t &segmentSize : header.segmentSizes) {
+            if (!readVarint(data, end, segmentSize) || segmentSize > (uint64_t)(end - data)) return false;
+            total += segmentSize;
+        }
+        if (total * 8 != header.encodedBits) return false;
+    }
+    return true;
+}
+
+bool parseContainerHeader(const unsigned char *data, size_t size, JpegContainerHeader &header, size_t &payloadOffset) {
+    const unsigned char *position = data;
+    const unsigned char *end = data + size;
+
+    const bool canonical = size >= 4 && memcmp(data, containerMagic, 4) == 0;
+    if (!(canonical ? parseCanonicalHeader(position, end, header) : parseLegacyHeader(position, end, header))) {
+        return false;
+    }
+
+    // Legacy files count whole bytes only, canonical ones the exact number of bits
+    payloadOffset = position - data;
+    return (header.encodedBits + 7) / 8 <= size - payloadOffset;
+}
+
+// openTemporaryFile()
+// Description: Creates a file of a unique name next to the destination, so that writers of the
+//              same destination running at the same time never share their temporary file
+// Input: const string &path - destination file
+//        string &temporaryPath - receives the name of the temporary file
+// Output: FILE* - the temporary file open for writing, nullptr if it could not be created
+static FILE *openTemporaryFile(const string &path, string &temporaryPath) {
+#if defined(JPEG_CONTAINER_MMAP)
+    string pattern = path + ".XXXXXX";
+    const int descriptor = mkstemp(&pattern[0]);
+    if (descriptor < 0) return nullptr;
+    temporaryPath = pattern;
+
+    // mkstemp() leaves the file to its owner only, the destination gets the usual permissions
+    FILE *file = fchmod(descriptor, 0644) == 0 ? fdopen(descriptor, "wb") : nullptr;
+    if (!file) {
+        ::close(descriptor);
+        remove(temporaryPath.c_str());
+    }
+    return file;
+#else
+    // "x" fails on an existing file, another random name is tried then
+    random_device source;
+    for (int attempt = 0; attempt < 16; attempt++) {
+        temporaryPath = path + "." + to_string(source()) + ".tmp";
+        if (FILE *file = fopen(temporaryPath.c_str(), "wbx")) return file;
+    }
+    return nullptr;
+#endif
+}
+
+bool writeFileAtomically(const string &path, const unsigned char *data, size_t size) {
+    string temporaryPath;
+    FILE *file = openTemporaryFile(path, temporaryPath);
+    if (!file) return false;
+
+    const bool written = fwrite(data, 1, size, file) == size;
+    if (fclose(file) != 0 || !written) {
+        remove(temporaryPath.c_str());
+        return false;
+    }
+
+    // rename() replaces the destination atomically on POSIX; elsewhere it refuses to, so the old
+    // file has to go first
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        remove(path.c_str());
+        if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MappedFile::open(const string &path) {
+    close();
+
+#if defined(JPEG_CONTAINER_MMAP)
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        ::close(descriptor);
+        return false;
+    }
+
+    // An empty file cannot be mapped, but it is a valid (empty) view
+    length = (size_t)status.st_size;
+    if (length > 0) {
+        void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED) {
+            ::close(descriptor);
+            length = 0;
+            return false;
+        }
+
+        bytes = (const unsigned char*)address;
+        mapped = true;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(descriptor);
+    return true;
+#else
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    unsigned char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        fallback.insert(fallback.end(), buffer, buffer + count);
+    }
+    fclose(file);
+
+    bytes = fallback.data();
+    length = fallback.size();
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+#if defined(JPEG_CONTAINER_MMAP)
+    if (mapped) munmap((void*)bytes, length);
+#endif
+    bytes = nullptr;
+    length = 0;
+    mapped = false;
+    fallback.clear();
+}
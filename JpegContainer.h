@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "JpegHuffman.h"
+
+// Container versions of the .dat files (see jpegformat.txt)
+static const int JPEG_FORMAT_LEGACY = 1;    // raw int header with the Huffman frequency table
+static const int JPEG_FORMAT_CANONICAL = 2; // "SJPG" header with canonical Huffman code lengths
+static const int JPEG_FORMAT_RUN_SIZE = 3;  // "SJPG" header, blocks coded as (run, size) symbols
+
+// Header flags (version 3)
+static const int JPEG_FLAG_RESTARTS = 0x01;    // payload split into byte-aligned restart segments
+static const int JPEG_FLAG_SUBSAMPLING = 0x02; // chroma sampled at a lower resolution than luma
+
+// JpegContainerHeader
+// Everything in a .dat header besides the entropy-coded payload. Legacy files carry the frequency
+// table the Huffman tree is rebuilt from, later versions carry code lengths directly: one table of
+// RLE values in version 2, DC/AC table pairs (luma, then chroma) in version 3
+typedef struct JpegContainerHeader {
+    int version = JPEG_FORMAT_CANONICAL;
+    int flags = 0;
+    int quality = 0;
+    int height = 0;
+    int width = 0;
+    int rleSize = 0;
+    uint64_t encodedBits = 0;
+    int hSampling = 1;                         // luma blocks per MCU horizontally (JPEG_FLAG_SUBSAMPLING)
+    int vSampling = 1;                         // luma blocks per MCU vertically
+    std::map<int, int> frequencies;             // legacy only
+    std::vector<std::vector<HuffmanCodeLength>> codeTables; // version 2 and later
+    int restartInterval = 0;                   // MCU rows per restart segment (JPEG_FLAG_RESTARTS)
+    std::vector<uint64_t> segmentSizes;        // byte size of each restart segment
+} JpegContainerHeader;
+
+// writeVarint()
+// Description: Appends an unsigned LEB128 varint (7 bits per byte, low bits first)
+void writeVarint(std::vector<unsigned char> &output, uint64_t value);
+
+// writeSignedVarint()
+// Description: Appends a signed varint (zigzag mapped, so small magnitudes stay short)
+void writeSignedVarint(std::vector<unsigned char> &output, int64_t value);
+
+// readVarint()
+// Description: Reads an unsigned varint, advancing data
+// Output: bool - false if the varint runs past end or does not fit in 64 bits
+bool readVarint(const unsigned char *&data, const unsigned char *end, uint64_t &value);
+
+// readSignedVarint()
+// Description: Reads a zigzag mapped signed varint, advancing data
+// Output: bool - false if the varint runs past end or does not fit in 64 bits
+bool readSignedVarint(const unsigned char *&data, const unsigned char *end, int64_t &value);
+
+// writeContainerHeader()
+// Description: Appends the header of a .dat file in the given version
+// Input: vector<unsigned char> &output - buffer the header is appended to
+//        const JpegContainerHeader &header - header fields (the payload follows the header and is
+//                                            ceil(encodedBits / 8) bytes long)
+// Output: No return value, modifies the output buffer
+void writeContainerHeader(std::vector<unsigned char> &output, const JpegContainerHeader &header);
+
+// parseContainerHeader()
+// Description: Parses the header of a .dat file of any version
+// Input: const unsigned char *data, size_t size - contents of the file
+//        JpegContainerHeader &header - receives the header fields
+//        size_t &payloadOffset - receives the offset of the entropy-coded payload
+// Output: bool - false if the header is malformed or the payload is cut short
+bool parseContainerHeader(const unsigned char *data, size_t size, JpegContainerHeader &header, size_t &payloadOffset);
+
+// writeFileAtomically()
+// Description: Writes a file with a single write to a temporary file next to it (of a name unique
+//              to this call), then renames the temporary file over the destination, so the
+//              destination is either the old or the new file and never a partial one
+// Input: const string &path - destination file
+//        const unsigned char *data, size_t size - contents of the file
+// Output: bool - false if the file could not be written (the destination is left untouched)
+bool writeFileAtomically(const std::string &path, const unsigned char *data, size_t size);
+
+// MappedFile
+// Read-only view of a whole file, memory-mapped where the platform supports it (read into memory
+// otherwise), so a .dat file is parsed and entropy-decoded in place without copies
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // open()
+    // Description: Maps the file at path, replacing any file mapped before
+    // Output: bool - false if the file could not be opened or mapped
+    bool open(const std::string &path);
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<unsigned char> fallback;
+};
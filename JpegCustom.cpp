@@ -1,5 +1,6 @@
 #include <queue>
 #include <algorithm>
+#include <cstring>
 #include "JpegCustom.h"
 
 using namespace std;
@@ -29,13 +30,53 @@ void JpegImage::encodeJpeg(const string& outputFilename, const string& message)
 }
 
 // encodeJpeg()
-// Description: Encodes an image to a (custom) jpg file
+// Description: Encodes an image to a (custom) jpg file. The whole container is built in memory and
+//              written with a single write to a temporary file that is then renamed over the
+//              output, so readers never see a partial file
 // Input: string outputFilename - path to the output jpg file
 // Output: No return value, modifies the output jpg file
 void JpegImage::encodeJpeg(const std::string& outputFilename, const bool useStego, const std::string& message) {
+    vector<unsigned char> container;
+    if (!encodeContainer(useStego, message, container)) {
+        return;
+    }
+
+    log("Writing to file");
+    if (!writeFileAtomically(outputFilename, container.data(), container.size())) {
+        cout << "Failed to write " << outputFilename << " - JpegImage::encodeJpeg" << endl;
+        return;
+    }
+    cout << "Encoded data written to file " << outputFilename << endl;
+
+    // Success message
+    log("Image successfully encoded to " + outputFilename);
+}
+
+// encodeJpegToMemory()
+// Description: Encodes an image to the bytes of a (custom) jpg file without touching the disk
+// Input: bool useStego - whether to hide the message in the image
+//        string message - message to be encoded
+// Output: vector<unsigned char> - contents of the jpg file (empty on failure)
+vector<unsigned char> JpegImage::encodeJpegToMemory(const bool useStego, const std::string& message) {
+    vector<unsigned char> container;
+    if (!encodeContainer(useStego, message, container)) {
+        container.clear();
+    }
+
+    return container;
+}
+
+// encodeContainer()
+// Description: Runs the encoding pipeline and serializes the header and the entropy-coded data into
+//              one buffer, sized up front from the header and the exact payload size
+// Input: bool useStego - whether to hide the message in the image
+//        string message - message to be encoded
+//        vector<unsigned char> &output - receives the contents of the jpg file
+// Output: bool - whether the image was encoded
+bool JpegImage::encodeContainer(const bool useStego, const std::string& message, vector<unsigned char>& output) {
     if (!ycbcrLoaded && !rgbLoaded) {
         cout << "No data loaded - JpegImage::encodeJpeg" << endl;
-        return;
+        return false;
     }
 
     // If RGB data is loaded, convert to YCbCr
@@ -44,18 +85,22 @@ void JpegImage::encodeJpeg(const std::string& outputFilename, const bool useSteg
         rgbToYCbCr();
     }
 
-    // If YCbCr data is loaded, generate DCT blocks
+    // If YCbCr data is loaded, generate the quantized DCT blocks in one pass
     if (ycbcrLoaded) {
-        log("Generating DCT blocks");
-        generateDCTBlocks();
-    }
-
-    // If DCT blocks are generated, quantize the blocks
-    if (dctBlocksGenerated) {
+        log("Generating quantized DCT blocks");
+        generateQuantizedDCTBlocks();
+    } else if (dctBlocksGenerated) {
+        // Otherwise quantize previously generated DCT blocks
         log("Quantizing blocks");
         generateQuantizedBlocks();
     }
 
+    // The RLE stream of versions 1 and 2 interleaves full resolution blocks only
+    if (quantizedBlocks.subsampled() && formatVersion != JPEG_FORMAT_RUN_SIZE) {
+        cout << "Chroma subsampling needs container version 3 - JpegImage::encodeJpeg" << endl;
+        return false;
+    }
+
     if (useStego) {
         log("Encoding message within LSB of quantized DCT coefficients");
         encodeLSBOnQuantizedBlocks(message);
@@ -63,6 +108,33 @@ void JpegImage::encodeJpeg(const std::string& outputFilename, const bool useSteg
 
     successfullyEncoded = true;
 
+    JpegContainerHeader header;
+    header.version = formatVersion;
+    header.quality = quality;
+    header.height = height;
+    header.width = width;
+    if (quantizedBlocks.subsampled()) {
+        header.flags |= JPEG_FLAG_SUBSAMPLING;
+        header.hSampling = quantizedBlocks.hSampling();
+        header.vSampling = quantizedBlocks.vSampling();
+    }
+
+    if (formatVersion == JPEG_FORMAT_RUN_SIZE) {
+        encodeRunSizeEntropy(header, output);
+    } else {
+        encodeRleEntropy(header, output);
+    }
+
+    return true;
+}
+
+// encodeRleEntropy()
+// Description: Codes the quantized blocks as a Huffman-coded RLE sequence of the zigzag scan
+//              (legacy and canonical containers) and serializes the container
+// Input: JpegContainerHeader &header - header with the image fields filled in
+//        vector<unsigned char> &output - receives the contents of the jpg file
+// Output: No return value, modifies the header and the output
+void JpegImage::encodeRleEntropy(JpegContainerHeader& header, vector<unsigned char>& output) {
     // If quantized blocks are generated, convert to zigzag sequence
     log("Converting to zigzag sequence");
     vector<int> sequence;
@@ -79,158 +151,760 @@ void JpegImage::encodeJpeg(const std::string& outputFilename, const bool useSteg
     log("Calculating frequencies");
     map<int, int> frequencies = calculateFrequencies(rleSequence);
 
-    log("Building Huffman tree");
-    HuffmanNode* huffmanTree = buildHuffmanTree(frequencies);
+    header.rleSize = rleSequence.size();
 
-    log("Generating Huffman codes");
-    map<int, string> huffmanCodes = generateHuffmanCodes(huffmanTree);
+    HuffmanCodeTable huffmanCodes;
+    if (formatVersion == JPEG_FORMAT_LEGACY) {
+        // Legacy files store the frequency table, the decoder rebuilds the same tree from it
+        log("Building Huffman tree");
+        HuffmanNode* huffmanTree = buildHuffmanTree(frequencies);
 
-    log("Encoding data with Huffman codes");
-    string encodedData = encodeData(rleSequence, huffmanCodes);
+        log("Generating Huffman codes");
+        huffmanCodes = generateHuffmanCodes(huffmanTree);
+        header.frequencies = frequencies;
+    } else {
+        // Canonical files store the (length-limited) code lengths, the codes follow from them
+        log("Generating canonical Huffman codes");
+        header.codeTables.assign(1, buildHuffmanCodeLengths(frequencies, HUFFMAN_MAX_CODE_LENGTH));
+        buildCanonicalHuffmanCodes(header.codeTables[0], huffmanCodes);
+    }
 
-    // Opening file for writing if encoding is successful
-    if (!successfullyEncoded) {
-        cout << "Failed to encode image - JpegImage::encodeJpeg" << endl;
-        return;
+    // Exact size of the packed bitstream, known from the frequencies and code lengths
+    uint64_t encodedBits = 0;
+    for (auto const& x : frequencies) {
+        encodedBits += (uint64_t)x.second * huffmanCodes[x.first].length;
     }
 
-    log("Writing to file");
-    ofstream file(outputFilename, ios::binary);
+    header.encodedBits = encodedBits;
 
-    // Writing jpeg quality
-    file.write((char*)&quality, sizeof(int));
+    // Serializing the header (quality, dimensions, Huffman table and sizes, see jpegformat.txt),
+    // then packing the encoded data right behind it in the same buffer
+    log("Serializing header");
+    output.clear();
+    writeContainerHeader(output, header);
+    output.reserve(output.size() + (encodedBits + 7) / 8);
 
-    // Writing integer of height and width
-    file.write((char*)&height, sizeof(int));
-    file.write((char*)&width, sizeof(int));
+    log("Writing RLE sequence size: " + to_string(header.rleSize));
 
-    // Writing size of frequency table
-    unsigned int freqSize = frequencies.size();
-    file.write((char*)&freqSize, sizeof(unsigned int));
+    log("Encoding data with Huffman codes");
+    encodeData(rleSequence, huffmanCodes, output);
 
-    // Writing frequency table
-    log("Writing frequency table");
-    for (auto const& x : frequencies) {
-        file.write((char*)&x.first, sizeof(int));
-        file.write((char*)&x.second, sizeof(int));
+    log("Writing encoded data size: " + to_string((encodedBits + 7) / 8));
+}
+
+// runSizeCodeLengths()
+// Description: Canonical code lengths of the symbols counted in one (run, size) alphabet
+static vector<HuffmanCodeLength> runSizeCodeLengths(const uint32_t *counts, int symbols) {
+    map<int, int> frequencies;
+    for (int symbol = 0; symbol < symbols; symbol++) {
+        if (counts[symbol]) frequencies[symbol] = counts[symbol];
     }
 
-    // Writing size of encoded data
-    int encodedSize = encodedData.size() / 8;
-    file.write((char*)&encodedSize, sizeof(int));
+    return buildHuffmanCodeLengths(frequencies, HUFFMAN_MAX_CODE_LENGTH);
+}
 
-    // Write RLE sequence size
-    int rleSize = rleSequence.size();
-    file.write((char*)&rleSize, sizeof(int));
+// runSizeTables()
+// Description: Builds the DC and AC tables of the first slots table slots
+// Input: const RunSizeFrequencies &frequencies - symbol counts
+//        int slots - number of slots in use
+//        vector<vector<HuffmanCodeLength>> &tables - receives the code lengths (DC, AC per slot)
+//        RunSizeCodes &codes - receives the codes
+// Output: uint64_t - exact size in bits of the symbols coded with these tables
+static uint64_t runSizeTables(const RunSizeFrequencies &frequencies, int slots, vector<vector<HuffmanCodeLength>> &tables, RunSizeCodes &codes) {
+    uint64_t bits = frequencies.amplitudeBits;
+    tables.clear();
+    for (int slot = 0; slot < slots; slot++) {
+        tables.push_back(runSizeCodeLengths(frequencies.dc[slot], RUN_SIZE_DC_SYMBOLS));
+        tables.push_back(runSizeCodeLengths(frequencies.ac[slot], RUN_SIZE_AC_SYMBOLS));
+        buildCanonicalHuffmanCodes(tables[2 * slot], codes.dc[slot]);
+        buildCanonicalHuffmanCodes(tables[2 * slot + 1], codes.ac[slot]);
+
+        for (int symbol = 0; symbol < RUN_SIZE_DC_SYMBOLS; symbol++) {
+            if (frequencies.dc[slot][symbol]) bits += (uint64_t)frequencies.dc[slot][symbol] * codes.dc[slot][symbol].length;
+        }
+        for (int symbol = 0; symbol < RUN_SIZE_AC_SYMBOLS; symbol++) {
+            if (frequencies.ac[slot][symbol]) bits += (uint64_t)frequencies.ac[slot][symbol] * codes.ac[slot][symbol].length;
+        }
+    }
 
-    log("Writing RLE sequence size: " + to_string(rleSize));
+    return bits;
+}
 
-    log("Writing encoded data size: " + to_string(encodedSize));
+// encodeRunSizeEntropy()
+// Description: Codes the quantized blocks as JPEG-style (run, size) symbols with DC prediction
+//              and serializes the container, the symbol counts of a first pass giving the tables.
+//              With a restart interval every segment is counted and coded on its own thread
+// Input: JpegContainerHeader &header - header with the image fields filled in
+//        vector<unsigned char> &output - receives the contents of the jpg file
+// Output: No return value, modifies the header and the output
+void JpegImage::encodeRunSizeEntropy(JpegContainerHeader& header, vector<unsigned char>& output) {
+    const BlockPlanes blocks = quantizedPlanes();
+
+    // Symbols are counted for luma (slot 0) and the sparser chroma channels (slot 1) apart
+    const int countSlot[3] = {0, 1, 1};
+
+    // MCU rows of each restart segment
+    const int mcuRows = blocks.mcuRows();
+    const int interval = restartInterval > 0 ? restartInterval : max(mcuRows, 1);
+    const int segmentCount = (mcuRows + interval - 1) / interval;
+    auto forEachSegment = [&](const function<void(int, int, int)> &body) {
+        ThreadPool::shared().parallelFor(0, segmentCount, threadCount, [&](int begin, int end) {
+            for (int s = begin; s < end; s++) body(s, s * interval, min(mcuRows, (s + 1) * interval));
+        });
+    };
 
-    // Closing file and appending encoded data
-    file.close();
+    // Counting per segment, the sums in segment order keep the tables independent of the threads
+    log("Counting (run, size) symbols");
+    vector<RunSizeFrequencies> segmentFrequencies(segmentCount);
+    forEachSegment([&](int s, int rowBegin, int rowEnd) {
+        countRunSizeSymbols(blocks, rowBegin, rowEnd, countSlot, segmentFrequencies[s]);
+    });
+
+    RunSizeFrequencies frequencies;
+    for (const RunSizeFrequencies &segment : segmentFrequencies) {
+        addRunSizeFrequencies(frequencies, segment);
+    }
+
+    // Luma and chroma tables (DC luma, AC luma, DC chroma, AC chroma), or one DC/AC pair shared
+    // by the channels when that makes the smaller file - on small images the extra tables cost
+    // more than they save
+    log("Generating canonical Huffman codes");
+    RunSizeCodes codes;
+    uint64_t encodedBits = runSizeTables(frequencies, RUN_SIZE_TABLE_SLOTS, header.codeTables, codes);
+
+    RunSizeFrequencies sharedFrequencies = frequencies;
+    for (int symbol = 0; symbol < RUN_SIZE_DC_SYMBOLS; symbol++) sharedFrequencies.dc[0][symbol] += frequencies.dc[1][symbol];
+    for (int symbol = 0; symbol < RUN_SIZE_AC_SYMBOLS; symbol++) sharedFrequencies.ac[0][symbol] += frequencies.ac[1][symbol];
+
+    JpegContainerHeader sharedHeader = header;
+    RunSizeCodes sharedCodes;
+    const uint64_t sharedBits = runSizeTables(sharedFrequencies, 1, sharedHeader.codeTables, sharedCodes);
+
+    vector<unsigned char> splitTables, sharedTables;
+    writeContainerHeader(splitTables, header);
+    writeContainerHeader(sharedTables, sharedHeader);
+
+    int tableSlot[3] = {0, 1, 1};
+    if (sharedTables.size() * 8 + sharedBits < splitTables.size() * 8 + encodedBits) {
+        log("Sharing one DC/AC table pair between the channels");
+        header.codeTables = move(sharedHeader.codeTables);
+        codes = move(sharedCodes);
+        encodedBits = sharedBits;
+        tableSlot[1] = tableSlot[2] = 0;
+    }
+    header.encodedBits = encodedBits;
+
+    if (restartInterval == 0) {
+        log("Serializing header");
+        output.clear();
+        writeContainerHeader(output, header);
+        output.reserve(output.size() + (encodedBits + 7) / 8);
+
+        log("Encoding blocks with (run, size) codes");
+        BitWriter writer(output);
+        encodeRunSizeBlocks(blocks, 0, mcuRows, tableSlot, codes, writer);
+        writer.flush();
+
+        log("Writing encoded data size: " + to_string((encodedBits + 7) / 8));
+        return;
+    }
 
-    log("Appending encoded data");
-    appendEncodedDataToFile(encodedData, outputFilename);
-    cout << "Encoded data appended to file " << outputFilename << endl;
+    // Restart segments: each one padded to a whole byte, their sizes going to the segment index
+    log("Encoding " + to_string(segmentCount) + " restart segments with (run, size) codes");
+    vector<vector<unsigned char>> segments(segmentCount);
+    forEachSegment([&](int s, int rowBegin, int rowEnd) {
+        BitWriter writer(segments[s]);
+        encodeRunSizeBlocks(blocks, rowBegin, rowEnd, tableSlot, codes, writer);
+        writer.flush();
+    });
 
-    // Success message
-    log("Image successfully encoded to " + outputFilename);
+    header.flags |= JPEG_FLAG_RESTARTS;
+    header.restartInterval = interval;
+    header.segmentSizes.resize(segmentCount);
+    size_t payloadSize = 0;
+    for (int s = 0; s < segmentCount; s++) {
+        header.segmentSizes[s] = segments[s].size();
+        payloadSize += segments[s].size();
+    }
+    header.encodedBits = (uint64_t)payloadSize * 8;
+
+    log("Serializing header");
+    output.clear();
+    writeContainerHeader(output, header);
+    output.reserve(output.size() + payloadSize);
+    for (const vector<unsigned char> &segment : segments) {
+        output.insert(output.end(), segment.begin(), segment.end());
+    }
+
+    log("Writing encoded data size: " + to_string(payloadSize));
 }
 
 
 // decodeJpeg()
-// Description: Decodes a (custom) jpg file to an image
+// Description: Decodes a (custom) jpg file to an image, reading it in place through a memory map
 // Input: string inputFilename - path to the input jpg file
-void JpegImage::decodeJpeg(const std::string& inputFilename) {
-    // Variable declaration
-    int fileQuality;
+//        DecodeUntil until - last stage to run (the coefficients are enough to extract a message)
+void JpegImage::decodeJpeg(const std::string& inputFilename, DecodeUntil until) {
+    log("Mapping file");
+    MappedFile file;
+    if (!file.open(inputFilename)) {
+        cout << "Failed to open " << inputFilename << " - JpegImage::decodeJpeg" << endl;
+        return;
+    }
 
-    // Opening file for reading
-    log("Reading from file");
-    ifstream file(inputFilename, ios::binary);
+    decodeJpegFromMemory(file.data(), file.size(), until);
+}
 
-    // Reading jpeg quality
-    file.read((char*)&fileQuality, sizeof(int));
-    setQuality(fileQuality);
+// decodeJpegFromMemory()
+// Description: Decodes the bytes of a (custom) jpg file to an image. The header is parsed and the
+//              payload entropy-decoded straight from the caller's bytes, nothing is copied
+// Input: const unsigned char* data, size_t size - contents of the jpg file
+//        DecodeUntil until - last stage to run
+void JpegImage::decodeJpegFromMemory(const unsigned char* data, size_t size, DecodeUntil until) {
+    // Entropy decoding straight into the quantized blocks
+    if (!decodeCoefficients(data, size) || until == DecodeUntil::Coefficients) {
+        return;
+    }
 
-    log("Jpeg quality: " + to_string(fileQuality));
+    // Dequantize blocks
+    log("Dequantizing blocks");
+    dequantizeBlocks();
 
-    // Reading height and width
-    file.read((char*)&height, sizeof(int));
-    file.read((char*)&width, sizeof(int));
+    if (until == DecodeUntil::DctCoefficients) {
+        return;
+    }
 
-    log("Height: " + to_string(height) + ", Width: " + to_string(width));
+    // Invert DCT blocks
+    log("Inverting DCT blocks");
+    invertDCTBlocks();
+
+    // Convert YCbCr to RGB
+    log("Converting YCbCr to RGB");
+    yCbCrToRGB();
+}
 
-    // Reading size of frequency table
-    unsigned int freqSize;
-    file.read((char*)&freqSize, sizeof(unsigned int));
+// decodeJpegScaled()
+// Description: Decodes a (custom) jpg file to an image at 1/2, 1/4 or 1/8 of its size (previews).
+//              Blocks are entropy-decoded one at a time into a scratch block and each becomes 4x4,
+//              2x2 or 1 pixel right away through a reduced inverse DCT of its top-left coefficients
+//              (the DC alone at 1/8), so neither coefficient planes nor full-size pixels are built
+// Input: string inputFilename - path to the input jpg file
+//        int scale - 1, 2, 4 or 8: the image is decoded at 1/scale of its width and height
+void JpegImage::decodeJpegScaled(const std::string& inputFilename, int scale) {
+    MappedFile file;
+    if (!file.open(inputFilename)) {
+        cout << "Failed to open " << inputFilename << " - JpegImage::decodeJpegScaled" << endl;
+        return;
+    }
 
-    // Reading frequency table
-    log("Reading frequency table");
+    decodeJpegScaledFromMemory(file.data(), file.size(), scale);
+}
 
-    map<int, int> frequencies;
-    for (int i = 0; i < freqSize; i++) {
-        int key, value;
-        file.read((char*)&key, sizeof(int));
-        file.read((char*)&value, sizeof(int));
-        frequencies[key] = value;
+// decodeJpegScaledFromMemory()
+// Description: Decodes the bytes of a (custom) jpg file at 1/scale of its size, see decodeJpegScaled()
+// Input: const unsigned char* data, size_t size - contents of the jpg file
+//        int scale - 1, 2, 4 or 8
+void JpegImage::decodeJpegScaledFromMemory(const unsigned char* data, size_t size, int scale) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        cout << "Scale must be 1, 2, 4 or 8 - JpegImage::decodeJpegScaled" << endl;
+        return;
+    }
+    if (scale == 1) {
+        decodeJpegFromMemory(data, size);
+        return;
     }
 
-    // Reading size of encoded data
-    int encodedSize;
-    file.read((char*)&encodedSize, sizeof(int));
+    JpegContainerHeader header;
+    size_t payloadOffset;
+    if (!readContainerHeader(data, size, header, payloadOffset)) {
+        return;
+    }
 
-    log("Encoded data size: " + to_string(encodedSize));
+    // Luma samples go straight into the (reduced) pixels. Subsampled chroma blocks cover twice the
+    // pixels, so they are reduced to twice the size into planes of their own, keeping one chroma
+    // sample per pixel along the subsampled direction (nearest along the other)
+    const BlockPlanes layout = { { nullptr, nullptr, nullptr }, height / 8, width / 8, header.hSampling, header.vSampling };
+    const int blockSize = 8 / scale;
+    const int chromaSize = layout.hSampling > 1 || layout.vSampling > 1 ? blockSize * 2 : blockSize;
+    const int chromaUp = chromaSize / blockSize;
+    const int hShift = layout.hSampling - 1;
+    const int vShift = layout.vSampling - 1;
+    const size_t chromaStride = (size_t)layout.planeCols(Cb) * chromaSize;
+    AlignedBuffer<unsigned char> chroma[3];
+    for (int k = Cb; k <= Cr; k++) {
+        chroma[k].allocate((size_t)layout.planeRows(k) * chromaSize * chromaStride);
+    }
+
+    // The image shrinks with its blocks (pixels past the last whole block stay empty, as in full
+    // size decoding)
+    height = (height * blockSize + 7) / 8;
+    width = (width * blockSize + 7) / 8;
+    pixelsYCbCr.allocate(width, height);
+
+    log("Decoding and inverting DCT blocks at 1/" + to_string(scale) + " scale");
+    auto reduceBlock = [&](int k, int row, int col, const coefficient* block) {
+        const int samplesSize = k == Y ? blockSize : chromaSize;
+        coefficient samples[64];
+        inverseDctBlocksScaled(block, samples, 1, samplesSize, &channelQuantTable(k));
+
+        for (int x = 0; x < samplesSize; x++) {
+            for (int y = 0; y < samplesSize; y++) {
+                const unsigned char sample = (unsigned char)min(max(16, samples[x * samplesSize + y]), 255);
+                if (k == Y) {
+                    pixelsYCbCr[row * blockSize + x][col * blockSize + y].y = sample;
+                } else {
+                    chroma[k][(row * chromaSize + x) * chromaStride + col * chromaSize + y] = sample;
+                }
+            }
+        }
+    };
 
-    // Read RLE sequence size
-    int rleSize;
-    file.read((char*)&rleSize, sizeof(int));
+    // Every block still has to be entropy-decoded: no container version records where a block's
+    // AC symbols end, so they are walked to reach the next block. Restart segments are decoded in
+    // parallel, each range of them filling its own MCU rows
+    const unsigned char* payload = data + payloadOffset;
+    const int mcuRows = layout.mcuRows();
+    bool valid;
+    if (header.version == JPEG_FORMAT_RUN_SIZE && (header.flags & JPEG_FLAG_RESTARTS)) {
+        const int interval = header.restartInterval;
+        const int segmentCount = (int)header.segmentSizes.size();
+        vector<char> rangeValid(segmentCount, 1);
+        ThreadPool::shared().parallelFor(0, segmentCount, threadCount, [&](int begin, int end) {
+            const int rowEnd = min(mcuRows, end * interval);
+            rangeValid[begin] = streamRunSizeBlocks(header, payload, begin * interval, [&](int k, int row, int col, const coefficient* block) {
+                if ((k == Y ? row / layout.vSampling : row) >= rowEnd) {
+                    return false;
+                }
+                reduceBlock(k, row, col, block);
+                return true;
+            });
+        });
+        valid = find(rangeValid.begin(), rangeValid.end(), 0) == rangeValid.end();
+    } else {
+        auto visit = [&](int k, int row, int col, const coefficient* block) {
+            reduceBlock(k, row, col, block);
+            return true;
+        };
+        valid = header.version == JPEG_FORMAT_RUN_SIZE ? streamRunSizeBlocks(header, payload, 0, visit)
+                                                        : streamRleBlocks(header, payload, visit);
+    }
+    if (!valid) {
+        return;
+    }
 
-    log("RLE sequence size: " + to_string(rleSize));
+    // Chroma of each pixel from the chroma planes
+    const int rows = layout.rows * blockSize;
+    const int cols = layout.cols * blockSize;
+    forEachRow(rows, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            const size_t chromaRow = (size_t)((i * chromaUp) >> vShift) * chromaStride;
+            ycbcr* row = pixelsYCbCr[i];
 
-    // Starting byte
-    int startByte = file.tellg();
+            for (int j = 0; j < cols; j++) {
+                const size_t chromaIndex = chromaRow + ((j * chromaUp) >> hShift);
+                row[j].cb = chroma[Cb][chromaIndex];
+                row[j].cr = chroma[Cr][chromaIndex];
+            }
+        }
+    });
+    ycbcrLoaded = true;
 
-    // Closing file
-    file.close();
+    log("Converting YCbCr to RGB");
+    yCbCrToRGB();
+}
+
+// decodeJpegRegion()
+// Description: Decodes the region (x, y, w, h) of a (custom) jpg file, the image becoming that
+//              w x h crop. Only the MCUs covering the region are kept and reconstructed; entropy
+//              decoding stops after the last MCU row of the region and, in files with restart
+//              segments, starts at the segment holding its first one
+// Input: string inputFilename - path to the input jpg file
+//        int x, int y - top-left pixel of the region
+//        int w, int h - size of the region, which must lie within the image
+void JpegImage::decodeJpegRegion(const std::string& inputFilename, int x, int y, int w, int h) {
+    MappedFile file;
+    if (!file.open(inputFilename)) {
+        cout << "Failed to open " << inputFilename << " - JpegImage::decodeJpegRegion" << endl;
+        return;
+    }
+
+    decodeJpegRegionFromMemory(file.data(), file.size(), x, y, w, h);
+}
+
+// decodeJpegRegionFromMemory()
+// Description: Decodes the region (x, y, w, h) of the bytes of a (custom) jpg file, see decodeJpegRegion()
+// Input: const unsigned char* data, size_t size - contents of the jpg file
+//        int x, int y, int w, int h - region to decode
+void JpegImage::decodeJpegRegionFromMemory(const unsigned char* data, size_t size, int x, int y, int w, int h) {
+    JpegContainerHeader header;
+    size_t payloadOffset;
+    if (!readContainerHeader(data, size, header, payloadOffset)) {
+        return;
+    }
+
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || x > width - w || y > height - h) {
+        cout << "Region outside the image - JpegImage::decodeJpegRegion" << endl;
+        return;
+    }
+
+    // Rectangle of whole MCUs covering the region (pixels past the last whole block are not coded)
+    const BlockPlanes layout = { { nullptr, nullptr, nullptr }, height / 8, width / 8, header.hSampling, header.vSampling };
+    const int mcuWidth = 8 * layout.hSampling;
+    const int mcuHeight = 8 * layout.vSampling;
+    const int mcuRowBegin = min(layout.mcuRows(), y / mcuHeight);
+    const int mcuRowEnd = min(layout.mcuRows(), (y + h - 1) / mcuHeight + 1);
+    const int mcuColBegin = min(layout.planeCols(1), x / mcuWidth);
+    const int mcuColEnd = min(layout.planeCols(1), (x + w - 1) / mcuWidth + 1);
+    const int rowBegin = mcuRowBegin * layout.vSampling;
+    const int colBegin = mcuColBegin * layout.hSampling;
+    quantizedBlocks.allocate(min(layout.rows, mcuRowEnd * layout.vSampling) - rowBegin, min(layout.cols, mcuColEnd * layout.hSampling) - colBegin,
+                             layout.hSampling, layout.vSampling);
+
+    // Entropy decoding in coding order, copying the blocks of the rectangle and stopping past it
+    log("Decoding the blocks of the region");
+    auto visit = [&](int k, int row, int col, const coefficient *block) {
+        const int mcuRow = k == Y ? row / layout.vSampling : row;
+        const int mcuCol = k == Y ? col / layout.hSampling : col;
+        if (mcuRow >= mcuRowEnd) {
+            return false;
+        }
+        if (mcuRow >= mcuRowBegin && mcuCol >= mcuColBegin && mcuCol < mcuColEnd) {
+            coefficient *target = k == Y ? quantizedBlocks.channel(k, row - rowBegin, col - colBegin)
+                                         : quantizedBlocks.channel(k, row - mcuRowBegin, col - mcuColBegin);
+            memcpy(target, block, 64 * sizeof(coefficient));
+        }
+        return true;
+    };
+
+    const unsigned char* payload = data + payloadOffset;
+    const bool valid = mcuRowBegin == mcuRowEnd ||
+                       (header.version == JPEG_FORMAT_RUN_SIZE ? streamRunSizeBlocks(header, payload, mcuRowBegin, visit)
+                                                                : streamRleBlocks(header, payload, visit));
+    if (!valid) {
+        return;
+    }
+    quantizedBlocksGenerated = true;
+
+    // Reconstructing the rectangle as if it were the whole image
+    height = quantizedBlocks.rows() * 8;
+    width = quantizedBlocks.cols() * 8;
+    log("Dequantizing blocks");
+    dequantizeBlocks();
+    log("Inverting DCT blocks");
+    invertDCTBlocks();
 
-    // Reading encoded data
-    log("Reading encoded data from file");
+    // Cropping to the region
+    const int top = y - rowBegin * 8;
+    const int left = x - colBegin * 8;
+    PixelBuffer<ycbcr> region;
+    region.allocate(w, h);
+    const int count = max(0, min(w, width - left));
+    for (int i = 0; i < h && top + i < height; i++) {
+        memcpy(region[i], pixelsYCbCr[top + i] + left, count * sizeof(ycbcr));
+    }
+    swap(pixelsYCbCr, region);
+    height = h;
+    width = w;
+    ycbcrLoaded = true;
 
-    string encodedData = readEncodedDataFromFile(inputFilename, startByte, encodedSize);
+    log("Converting YCbCr to RGB");
+    yCbCrToRGB();
+}
 
-    // Generating Huffman tree
-    log("Building Huffman tree");
+// decodeCoefficients()
+// Description: Parses the header of a (custom) jpg file and entropy-decodes its payload into the
+//              quantized blocks, taking the quality, size and chroma subsampling from the header
+// Input: const unsigned char* data, size_t size - contents of the jpg file
+// Output: bool - false if the file is invalid
+bool JpegImage::decodeCoefficients(const unsigned char* data, size_t size) {
+    JpegContainerHeader header;
+    size_t payloadOffset;
+    if (!readContainerHeader(data, size, header, payloadOffset)) {
+        return false;
+    }
+
+    // Entropy decoding straight into the quantized blocks
+    const unsigned char* payload = data + payloadOffset;
+    return header.version == JPEG_FORMAT_RUN_SIZE ? decodeRunSizeEntropy(header, payload)
+                                                   : decodeRleEntropy(header, payload);
+}
 
-    HuffmanNode* huffmanTree = buildHuffmanTree(frequencies);
+// readContainerHeader()
+// Description: Parses the header of a (custom) jpg file of any container version, taking the
+//              quality, size and chroma subsampling from it
+// Input: const unsigned char* data, size_t size - contents of the jpg file
+//        JpegContainerHeader &header - receives the header fields
+//        size_t &payloadOffset - receives the offset of the entropy-coded payload
+// Output: bool - false if the header is invalid
+bool JpegImage::readContainerHeader(const unsigned char* data, size_t size, JpegContainerHeader& header, size_t& payloadOffset) {
+    if (!parseContainerHeader(data, size, header, payloadOffset)) {
+        cout << "Invalid or truncated file - JpegImage::decodeJpeg" << endl;
+        return false;
+    }
+
+    setQuality(header.quality);
+    height = header.height;
+    width = header.width;
+    chromaSubsampling = header.hSampling == 1 ? ChromaSubsampling::Chroma444
+                      : header.vSampling == 1 ? ChromaSubsampling::Chroma422 : ChromaSubsampling::Chroma420;
+
+    log("Container version: " + to_string(header.version));
+    log("Jpeg quality: " + to_string(header.quality));
+    log("Height: " + to_string(height) + ", Width: " + to_string(width));
+    log("Encoded data size: " + to_string((header.encodedBits + 7) / 8));
+    log("RLE sequence size: " + to_string(header.rleSize));
+    return true;
+}
+
+// decodeRleEntropy()
+// Description: Decodes the Huffman-coded RLE sequence of a legacy or canonical container into the
+//              quantized blocks
+// Input: const JpegContainerHeader &header - parsed header
+//        const unsigned char* payload - entropy-coded data
+// Output: bool - false if the Huffman tables are invalid
+bool JpegImage::decodeRleEntropy(const JpegContainerHeader& header, const unsigned char* payload) {
+    // Building the Huffman lookup tables
+    HuffmanDecodeTable huffmanTable;
+    if (!buildRleDecodeTable(header, huffmanTable)) {
+        return false;
+    }
 
     // Decoding Huffman encoded data
     log("Decoding Huffman encoded data");
 
-    vector<int> rleSequence = decodeData(encodedData, huffmanTree);
+    vector<int> rleSequence = decodeData(payload, header.encodedBits, huffmanTable, header.rleSize);
 
     // Decoding RLE sequence
     log("Decoding RLE sequence");
 
     vector<int> sequence;
-    decodeRLE(rleSequence, sequence, rleSize);
+    decodeRLE(rleSequence, sequence, header.rleSize);
 
     // Inverse zigzag
     log("Performing inverse zigzag");
     inverseZigzag(sequence);
 
-    // Dequantize blocks
-    log("Dequantizing blocks");
-    dequantizeBlocks();
+    return true;
+}
 
-    // Invert DCT blocks
-    log("Inverting DCT blocks");
-    invertDCTBlocks();
+// buildRleDecodeTable()
+// Description: Builds the Huffman lookup tables of the RLE values of a legacy or canonical container
+// Input: const JpegContainerHeader &header - parsed header
+//        HuffmanDecodeTable &table - table to fill
+// Output: bool - false if the code lengths are invalid
+bool JpegImage::buildRleDecodeTable(const JpegContainerHeader& header, HuffmanDecodeTable& table) {
+    if (header.version == JPEG_FORMAT_LEGACY) {
+        // Generating Huffman tree
+        log("Building Huffman tree");
+
+        HuffmanNode* huffmanTree = buildHuffmanTree(header.frequencies);
+
+        // The codes go straight into the lookup tables: the symbols come from the file
+        vector<pair<int, HuffmanCode>> leaves;
+        if (!generateHuffmanCodesRecursive(huffmanTree, 0, 0, leaves) || !buildHuffmanDecodeTable(leaves, table)) {
+            cout << "Invalid Huffman frequency table - JpegImage::decodeJpeg" << endl;
+            return false;
+        }
+        return true;
+    }
 
-    // Convert YCbCr to RGB
-    log("Converting YCbCr to RGB");
-    yCbCrToRGB();
+    // Canonical codes follow from the code lengths alone
+    log("Building Huffman decoding tables");
+
+    if (header.codeTables.size() != 1 || !buildHuffmanDecodeTable(header.codeTables[0], table)) {
+        cout << "Invalid Huffman code lengths - JpegImage::decodeJpeg" << endl;
+        return false;
+    }
+    return true;
+}
+
+// buildRunSizeDecodeTables()
+// Description: Builds the Huffman lookup tables of a version 3 container. Two tables are shared by
+//              every channel, four give chroma its own pair
+// Input: const JpegContainerHeader &header - parsed header
+//        RunSizeDecodeTables &tables - tables to fill
+//        int tableSlot[3] - receives the table slot of each channel
+// Output: bool - false if the code lengths are invalid
+bool JpegImage::buildRunSizeDecodeTables(const JpegContainerHeader& header, RunSizeDecodeTables& tables, int tableSlot[3]) {
+    log("Building Huffman decoding tables");
+
+    const int slotCount = (int)header.codeTables.size() / 2;
+    tableSlot[Y] = 0;
+    tableSlot[Cb] = tableSlot[Cr] = slotCount - 1;
+
+    bool tablesValid = header.codeTables.size() == 2 || header.codeTables.size() == 2 * RUN_SIZE_TABLE_SLOTS;
+    for (int slot = 0; tablesValid && slot < slotCount; slot++) {
+        tablesValid = buildHuffmanDecodeTable(header.codeTables[2 * slot], tables.dc[slot]) &&
+                      buildHuffmanDecodeTable(header.codeTables[2 * slot + 1], tables.ac[slot]);
+    }
+    if (!tablesValid) {
+        cout << "Invalid Huffman code lengths - JpegImage::decodeJpeg" << endl;
+        return false;
+    }
+    return true;
+}
+
+// decodeRunSizeEntropy()
+// Description: Decodes the (run, size) symbols of every block straight into the quantized blocks,
+//              restart segments in parallel (each one fills its own block rows)
+// Input: const JpegContainerHeader &header - parsed header
+//        const unsigned char* payload - entropy-coded data
+// Output: bool - false if the Huffman tables or the data are invalid
+bool JpegImage::decodeRunSizeEntropy(const JpegContainerHeader& header, const unsigned char* payload) {
+    RunSizeDecodeTables tables;
+    int tableSlot[3];
+    if (!buildRunSizeDecodeTables(header, tables, tableSlot)) {
+        return false;
+    }
+
+    // Allocating zeroed coefficient planes, the decoder only writes the nonzero coefficients
+    log("Decoding (run, size) coded blocks");
+    quantizedBlocks.allocate(height / 8, width / 8, header.hSampling, header.vSampling);
+    BlockPlanes blocks = quantizedPlanes();
+    const int mcuRows = blocks.mcuRows();
+
+    bool valid;
+    if (header.flags & JPEG_FLAG_RESTARTS) {
+        // Segment offsets from the sizes in the index
+        const int segmentCount = (int)header.segmentSizes.size();
+        vector<size_t> offsets(segmentCount + 1, 0);
+        for (int s = 0; s < segmentCount; s++) {
+            offsets[s + 1] = offsets[s] + header.segmentSizes[s];
+        }
+
+        vector<char> segmentValid(segmentCount, 0);
+        ThreadPool::shared().parallelFor(0, segmentCount, threadCount, [&](int begin, int end) {
+            for (int s = begin; s < end; s++) {
+                const int rowBegin = s * header.restartInterval;
+                const int rowEnd = min(mcuRows, rowBegin + header.restartInterval);
+
+                BitReader reader(payload + offsets[s], header.segmentSizes[s]);
+                segmentValid[s] = decodeRunSizeBlocks(reader, tables, tableSlot, blocks, rowBegin, rowEnd);
+            }
+        });
+        valid = find(segmentValid.begin(), segmentValid.end(), 0) == segmentValid.end();
+    } else {
+        BitReader reader(payload, (header.encodedBits + 7) / 8, header.encodedBits);
+        valid = decodeRunSizeBlocks(reader, tables, tableSlot, blocks, 0, mcuRows);
+    }
+
+    if (!valid) {
+        cout << "Corrupt encoded data - JpegImage::decodeJpeg" << endl;
+        return false;
+    }
+
+    quantizedBlocksGenerated = true;
+    return true;
+}
+
+// streamRleBlocks()
+// Description: Decodes the Huffman-coded RLE sequence of a legacy or canonical container lazily,
+//              handing over each block as soon as its 64 values are in. Values missing at the end
+//              of the sequence stay zero, as in the full decode
+// Input: const JpegContainerHeader &header - parsed header
+//        const unsigned char* payload - entropy-coded data
+//        visit - called with the channel, block row and column, and coefficients (row-major) of
+//                each block, returns false to stop
+// Output: bool - false if the Huffman tables are invalid
+bool JpegImage::streamRleBlocks(const JpegContainerHeader& header, const unsigned char* payload, const function<bool(int, int, int, const coefficient*)>& visit) {
+    HuffmanDecodeTable huffmanTable;
+    if (!buildRleDecodeTable(header, huffmanTable)) {
+        return false;
+    }
+
+    // An odd RLE size decodes to an empty sequence (see decodeRLE())
+    if (header.rleSize % 2 != 0) {
+        return true;
+    }
+
+    BitReader reader(payload, (header.encodedBits + 7) / 8, header.encodedBits);
+    int value = 0;
+    int remaining = 0;
+    bool more = true;
+
+    // Blocks come as Y, Cb and Cr per block position, 64 zigzag-ordered values each
+    alignas(64) coefficient block[64];
+    const int cols = header.width / 8;
+    const size_t blockCount = (size_t)(header.height / 8) * cols * 3;
+    for (size_t b = 0; b < blockCount && more; b++) {
+        memset(block, 0, sizeof(block));
+
+        for (int z = 0; z < 64 && more; z++) {
+            // Next (value, count) pair, up to the last complete one
+            while (remaining <= 0 && more) {
+                more = decodeHuffmanSymbol(reader, huffmanTable, value) && decodeHuffmanSymbol(reader, huffmanTable, remaining);
+            }
+            if (more) {
+                block[zigzagIndex[z]] = value;
+                remaining--;
+            }
+        }
+
+        const size_t position = b / 3;
+        if (!visit((int)(b % 3), (int)(position / cols), (int)(position % cols), block)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+// streamRunSizeBlocks()
+// Description: Decodes the blocks of a version 3 container one at a time in coding order, restart
+//              segment by restart segment. With restart segments, the segments before the one
+//              holding MCU row mcuRowBegin are skipped through the segment index
+// Input: const JpegContainerHeader &header - parsed header
+//        const unsigned char* payload - entropy-coded data
+//        int mcuRowBegin - MCU row to start at (blocks before it may still be visited)
+//        visit - called with the channel, block row and column within the channel's plane, and
+//                coefficients (row-major) of each block, returns false to stop
+// Output: bool - false if the Huffman tables or the data read are invalid
+bool JpegImage::streamRunSizeBlocks(const JpegContainerHeader& header, const unsigned char* payload, int mcuRowBegin,
+                                    const function<bool(int, int, int, const coefficient*)>& visit) {
+    RunSizeDecodeTables tables;
+    int tableSlot[3];
+    if (!buildRunSizeDecodeTables(header, tables, tableSlot)) {
+        return false;
+    }
+
+    // Layout of the planes, nothing is allocated
+    const BlockPlanes layout = { { nullptr, nullptr, nullptr }, header.height / 8, header.width / 8, header.hSampling, header.vSampling };
+    const int mcuRows = layout.mcuRows();
+    const bool restarts = (header.flags & JPEG_FLAG_RESTARTS) != 0;
+    const int interval = restarts ? header.restartInterval : max(mcuRows, 1);
+
+    alignas(64) coefficient block[64];
+    const int firstSegment = restarts ? mcuRowBegin / interval : 0;
+    size_t offset = 0;
+    for (int s = 0; s < firstSegment; s++) {
+        offset += header.segmentSizes[s];
+    }
+
+    for (int s = firstSegment; s * interval < mcuRows; s++) {
+        BitReader reader = restarts ? BitReader(payload + offset, header.segmentSizes[s])
+                                    : BitReader(payload, (header.encodedBits + 7) / 8, header.encodedBits);
+        if (restarts) {
+            offset += header.segmentSizes[s];
+        }
+
+        coefficient previousDc[3] = {0, 0, 0};
+        bool valid = true;
+        const bool finished = forEachMcuPosition(layout, s * interval, min(mcuRows, (s + 1) * interval), [&](int k, int row, int col) {
+            memset(block, 0, sizeof(block));
+            valid = decodeRunSizeBlock(reader, tables.dc[tableSlot[k]], tables.ac[tableSlot[k]], previousDc[k], block);
+            return valid && visit(k, row, col, block);
+        });
+
+        if (!valid) {
+            cout << "Corrupt encoded data - JpegImage::decodeJpeg" << endl;
+            return false;
+        }
+        if (!finished) {
+            break;
+        }
+    }
+
+    return true;
 }
 
 // displayImage()
@@ -249,18 +923,10 @@ void JpegImage::displayImage() {
         yCbCrToRGB();
     }
 
-    // Creating a CImg object
+    // Creating a CImg object from the pixel data
     log("Creating CImg object");
-    CImg<unsigned char> image(width, height, 1, 3);
-
-    // Filling the CImg object with pixel data
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            image(j, i, 0, 0) = pixelsRGB[i][j].r;
-            image(j, i, 0, 1) = pixelsRGB[i][j].g;
-            image(j, i, 0, 2) = pixelsRGB[i][j].b;
-        }
-    }
+    CImg<unsigned char> image;
+    copyToCImg(pixelsRGB, image);
 
     // Displaying the image
     log("Displaying image");
@@ -277,45 +943,45 @@ void JpegImage::displayImage() {
 }
 
 // loadPng()
-// Description: Loads a PNG image and stores the RGB values in the pixels 2D vector
+// Description: Loads a PNG image and stores the RGB values in the pixelsRGB buffer. PNG files are
+//              decoded in process straight into the buffer; other formats go through CImg
 // Input: string filename - path to the PNG image
-// Output: No return value, modifies the pixels 2D vector attribute
+// Output: No return value, modifies the pixelsRGB buffer attribute
 void JpegImage::loadPng(string filename) {
-    CImg<unsigned char>* image;
-
-    image = new CImg<unsigned char>(filename.c_str());
+    if (!readPngFile(filename, pixelsRGB)) {
+        CImg<unsigned char> image(filename.c_str());
+        copyFromCImg(image, pixelsRGB, image.width(), image.height());
+    }
 
-    // Getting image dimensions and resizing to multiples of 8
-    width = image->width() - (image->width() % 8);
-    height = image->height() - (image->height() % 8);
+    cropLoadedPixels();
+}
 
-    // Defining size of the pixels 2D vector
-    pixelsRGB.resize(height);
-    for (int i = 0; i < height; i++) {
-        pixelsRGB[i].resize(width);
+// loadPngFromMemory()
+// Description: Decodes a PNG image held in memory and stores the RGB values in the pixelsRGB buffer
+// Input: const unsigned char* data, size_t size - bytes of the PNG file
+// Output: No return value, modifies the pixelsRGB buffer attribute
+void JpegImage::loadPngFromMemory(const unsigned char* data, size_t size) {
+    if (!decodePng(data, size, pixelsRGB)) {
+        cout << "Invalid PNG data - JpegImage::loadPngFromMemory" << endl;
+        return;
     }
 
-    cimg_forXY(*image, x, y) {
-            if (x >= width || y >= height) {
-                break;
-            }
-
-            // Access pixel values at (x, y)
-            unsigned char pixelValue = (*image)(x, y, 0, 0);
+    cropLoadedPixels();
+}
 
-            // Adding pixel data to the pixels 2D vector
-            pixelsRGB[y][x].r = (*image)(x, y, 0, 0);
-            pixelsRGB[y][x].g = (*image)(x, y, 0, 1);
-            pixelsRGB[y][x].b = (*image)(x, y, 0, 2);
-        }
+// cropLoadedPixels()
+// Description: Crops freshly loaded pixels to multiples of 8 in both directions (whole blocks)
+// Output: No return value, modifies the width, height and pixelsRGB buffer attributes
+void JpegImage::cropLoadedPixels() {
+    width = pixelsRGB.width() - (pixelsRGB.width() % 8);
+    height = pixelsRGB.height() - (pixelsRGB.height() % 8);
+    pixelsRGB.crop(width, height);
 
     rgbLoaded = true;
-
-    delete image;
 }
 
 // savePng()
-// Description: Saves the RGB values in the pixels 2D vector to a PNG image
+// Description: Saves the RGB values in the pixelsRGB buffer to a PNG image
 // Input: string filename - path to the output PNG image
 // Output: No return value, saves the PNG image
 void JpegImage::savePng(string filename) {
@@ -325,31 +991,37 @@ void JpegImage::savePng(string filename) {
         return;
     }
 
-    // Creating a CImg object
-    CImg<unsigned char> image(width, height, 1, 3);
-
-    // Filling the CImg object with pixel data
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            image(j, i, 0, 0) = pixelsRGB[i][j].r;
-            image(j, i, 0, 0) = max(0, min(255, (int)image(j, i, 0, 0)));
-            image(j, i, 0, 1) = pixelsRGB[i][j].g;
-            image(j, i, 0, 1) = max(0, min(255, (int)image(j, i, 0, 1)));
-            image(j, i, 0, 2) = pixelsRGB[i][j].b;
-            image(j, i, 0, 2) = max(0, min(255, (int)image(j, i, 0, 2)));
-        }
+    // Encoding the image in process
+    if (!writePngFile(filename, pixelsRGB)) {
+        cout << "Failed to write " << filename << " - JpegImage::savePng" << endl;
+        return;
     }
 
-    // Saving the image
-    image.save(filename.c_str());
-
     // Success message
     cout << "Image successfully saved to " << filename << endl;
 }
 
+// savePngToMemory()
+// Description: Encodes the RGB values in the pixelsRGB buffer as a PNG image in memory
+// Output: vector<unsigned char> - bytes of the PNG file, empty on failure
+vector<unsigned char> JpegImage::savePngToMemory() {
+    vector<unsigned char> output;
+
+    if (!rgbLoaded) {
+        cout << "No RGB data loaded - JpegImage::savePngToMemory" << endl;
+        return output;
+    }
+    if (!encodePng(pixelsRGB, output)) {
+        cout << "Failed to encode the image - JpegImage::savePngToMemory" << endl;
+        output.clear();
+    }
+
+    return output;
+}
+
 // rgbToYCbCr()
-// Description: Converts RGB data to YCbCr and stores the values in the pixelsYCbCr 2D vector
-// Output: No return value, modifies the pixelsYCbCr 2D vector attribute
+// Description: Converts RGB data to YCbCr and stores the values in the pixelsYCbCr buffer
+// Output: No return value, modifies the pixelsYCbCr buffer attribute
 void JpegImage::rgbToYCbCr() {
     // Checking if RGB data is loaded
     if (!rgbLoaded) {
@@ -357,25 +1029,28 @@ void JpegImage::rgbToYCbCr() {
         return;
     }
 
-    pixelsYCbCr.resize(height);
+    pixelsYCbCr.allocate(width, height);
 
-    // Converting RGB to YCbCr
-    for (int i = 0; i < height; i++) {
-        pixelsYCbCr[i].resize(width);
+    // Converting RGB to YCbCr, each thread taking a range of pixel rows
+    forEachRow(height, [this](int first, int last) {
+        for (int i = first; i < last; i++) {
+            const color *rgb = pixelsRGB[i];
+            ycbcr *row = pixelsYCbCr[i];
 
-        for (int j = 0; j < width; j++) {
-            pixelsYCbCr[i][j].y = min(255, max(0, int(0.299 * pixelsRGB[i][j].r + 0.587 * pixelsRGB[i][j].g + 0.114 * pixelsRGB[i][j].b)));
-            pixelsYCbCr[i][j].cb = min(255, max(0, int(128 - 0.168736 * pixelsRGB[i][j].r - 0.331264 * pixelsRGB[i][j].g + 0.5 * pixelsRGB[i][j].b)));
-            pixelsYCbCr[i][j].cr = min(255, max(0, int(128 + 0.5 * pixelsRGB[i][j].r - 0.418688 * pixelsRGB[i][j].g - 0.081312 * pixelsRGB[i][j].b)));
+            for (int j = 0; j < width; j++) {
+                row[j].y = min(255, max(0, int(0.299 * rgb[j].r + 0.587 * rgb[j].g + 0.114 * rgb[j].b)));
+                row[j].cb = min(255, max(0, int(128 - 0.168736 * rgb[j].r - 0.331264 * rgb[j].g + 0.5 * rgb[j].b)));
+                row[j].cr = min(255, max(0, int(128 + 0.5 * rgb[j].r - 0.418688 * rgb[j].g - 0.081312 * rgb[j].b)));
+            }
         }
-    }
+    });
 
     ycbcrLoaded = true;
 }
 
 // yCbCrToRGB()
-// Description: Converts YCbCr data to RGB and stores the values in the pixelsRGB 2D vector
-// Output: No return value, modifies the pixelsRGB 2D vector attribute
+// Description: Converts YCbCr data to RGB and stores the values in the pixelsRGB buffer
+// Output: No return value, modifies the pixelsRGB buffer attribute
 void JpegImage::yCbCrToRGB() {
     // Checking if YCbCr data is loaded
     if (!ycbcrLoaded) {
@@ -383,18 +1058,21 @@ void JpegImage::yCbCrToRGB() {
         return;
     }
 
-    pixelsRGB.resize(height);
+    pixelsRGB.allocate(width, height);
 
-    // Converting YCbCr to RGB
-    for (int i = 0; i < height; i++) {
-        pixelsRGB[i].resize(width);
+    // Converting YCbCr to RGB, each thread taking a range of pixel rows
+    forEachRow(height, [this](int first, int last) {
+        for (int i = first; i < last; i++) {
+            const ycbcr *row = pixelsYCbCr[i];
+            color *rgb = pixelsRGB[i];
 
-        for (int j = 0; j < width; j++) {
-            pixelsRGB[i][j].r = min(255, max(0, int(pixelsYCbCr[i][j].y + 1.402 * (pixelsYCbCr[i][j].cr - 128))));
-            pixelsRGB[i][j].g = min(255, max(0, int(pixelsYCbCr[i][j].y - 0.344136 * (pixelsYCbCr[i][j].cb - 128) - 0.714136 * (pixelsYCbCr[i][j].cr - 128))));
-            pixelsRGB[i][j].b = min(255, max(0, int(pixelsYCbCr[i][j].y + 1.772 * (pixelsYCbCr[i][j].cb - 128))));
+            for (int j = 0; j < width; j++) {
+                rgb[j].r = min(255, max(0, int(row[j].y + 1.402 * (row[j].cr - 128))));
+                rgb[j].g = min(255, max(0, int(row[j].y - 0.344136 * (row[j].cb - 128) - 0.714136 * (row[j].cr - 128))));
+                rgb[j].b = min(255, max(0, int(row[j].y + 1.772 * (row[j].cb - 128))));
+            }
         }
-    }
+    });
 
     rgbLoaded = true;
 }
@@ -433,344 +1111,22 @@ void JpegImage::yCbCrToRGB() {
 //
 
 
-//Compute forward dct
-void JpegImage::dct2OnBlock(int** block, int** result) {
-    float component[64]; // Temporary array to store the floating-point version of the block
-
-    // Convert the int** input to a float* component
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 8; ++j) {
-            component[i * 8 + j] = static_cast<float>(block[i][j]);
-        }
-    }
-
-    /*Forward DCT constants*/
-    static const float a1 = 0.707;
-    static const float a2 = 0.541;
-    static const float a3 = 0.707;
-    static const float a4 = 1.307;
-    static const float a5 = 0.383;
-
-    static const float s0 = 0.353553;
-    static const float s1 = 0.254898;
-    static const float s2 = 0.270598;
-    static const float s3 = 0.300672;
-    static const float s4 = s0;
-    static const float s5 = 0.449988;
-    static const float s6 = 0.653281;
-    static const float s7 = 1.281458;
-
-    /*Forward DCT constants*/
-    for(int i = 0; i < 8; i++)
-    {
-        const float b0 = component[0*8 + i] + component[7*8 + i];
-        const float b1 = component[1*8 + i] + component[6*8 + i];
-        const float b2 = component[2*8 + i] + component[5*8 + i];
-        const float b3 = component[3*8 + i] + component[4*8 + i];
-        const float b4 =-component[4*8 + i] + component[3*8 + i];
-        const float b5 =-component[5*8 + i] + component[2*8 + i];
-        const float b6 =-component[6*8 + i] + component[1*8 + i];
-        const float b7 =-component[7*8 + i] + component[0*8 + i];
-
-        const float c0 = b0 + b3;
-        const float c1 = b1 + b2;
-        const float c2 =-b2 + b1;
-        const float c3 =-b3 + b0;
-        const float c4 =-b4 - b5;
-        const float c5 = b5 + b6;
-        const float c6 = b6 + b7;
-        const float c7 = b7;
-
-        const float d0 = c0 + c1;
-        const float d1 =-c1 + c0;
-        const float d2 = c2 + c3;
-        const float d3 = c3;
-        const float d4 = c4;
-        const float d5 = c5;
-        const float d6 = c6;
-        const float d7 = c7;
-        const float d8 = (d4+d6) * a5;
-
-        const float e0 = d0;
-        const float e1 = d1;
-        const float e2 = d2 * a1;
-        const float e3 = d3;
-        const float e4 = -d4 * a2 - d8;
-        const float e5 = d5 * a3;
-        const float e6 = d6 * a4 - d8;
-        const float e7 = d7;
-
-        const float f0 = e0;
-        const float f1 = e1;
-        const float f2 = e2 + e3;
-        const float f3 = e3 - e2;
-        const float f4 = e4;
-        const float f5 = e5 + e7;
-        const float f6 = e6;
-        const float f7 = e7 - e5;
-
-        const float g0 = f0;
-        const float g1 = f1;
-        const float g2 = f2;
-        const float g3 = f3;
-        const float g4 = f4 + f7;
-        const float g5 = f5 + f6;
-        const float g6 = -f6 + f5;
-        const float g7 = f7 - f4;
-
-        component[0*8 + i] = g0 * s0;
-        component[4*8 + i] = g1 * s4;
-        component[2*8 + i] = g2 * s2;
-        component[6*8 + i] = g3 * s6;
-        component[5*8 + i] = g4 * s5;
-        component[1*8 + i] = g5 * s1;
-        component[7*8 + i] = g6 * s7;
-        component[3*8 + i] = g7 * s3;
-    }
-
-    for(int i = 0; i < 8; i++)
-    {
-        const float b0 = component[i*8 + 0]  + component[i*8 + 7];
-        const float b1 = component[i*8 + 1]  + component[i*8 + 6];
-        const float b2 = component[i*8 + 2]  + component[i*8 + 5];
-        const float b3 = component[i*8 + 3]  + component[i*8 + 4];
-        const float b4 =-component[i*8 + 4]  + component[i*8 + 3];
-        const float b5 =-component[i*8 + 5]  + component[i*8 + 2];
-        const float b6 =-component[i*8 + 6]  + component[i*8 + 1];
-        const float b7 =-component[i*8 + 7]  + component[i*8 + 0] ;
-
-        const float c0 = b0 + b3;
-        const float c1 = b1 + b2;
-        const float c2 =-b2 + b1;
-        const float c3 =-b3 + b0;
-        const float c4 =-b4 - b5;
-        const float c5 = b5 + b6;
-        const float c6 = b6 + b7;
-        const float c7 = b7;
-
-        const float d0 = c0 + c1;
-        const float d1 =-c1 + c0;
-        const float d2 = c2 + c3;
-        const float d3 = c3;
-        const float d4 = c4;
-        const float d5 = c5;
-        const float d6 = c6;
-        const float d7 = c7;
-        const float d8 = (d4+d6) * a5;
-
-        const float e0 = d0;
-        const float e1 = d1;
-        const float e2 = d2 * a1;
-        const float e3 = d3;
-        const float e4 = -d4 * a2 - d8;
-        const float e5 = d5 * a3;
-        const float e6 = d6 * a4 - d8;
-        const float e7 = d7;
-
-        const float f0 = e0;
-        const float f1 = e1;
-        const float f2 = e2 + e3;
-        const float f3 = e3 - e2;
-        const float f4 = e4;
-        const float f5 = e5 + e7;
-        const float f6 = e6;
-        const float f7 = e7 - e5;
-
-        const float g0 = f0;
-        const float g1 = f1;
-        const float g2 = f2;
-        const float g3 = f3;
-        const float g4 = f4 + f7;
-        const float g5 = f5 + f6;
-        const float g6 = -f6 + f5;
-        const float g7 = f7 - f4;
-
-        component[i*8 + 0] = g0 * s0;
-        component[i*8 + 4] = g1 * s4;
-        component[i*8 + 2] = g2 * s2;
-        component[i*8 + 6] = g3 * s6;
-        component[i*8 + 5] = g4 * s5;
-        component[i*8 + 1] = g5 * s1;
-        component[i*8 + 7] = g6 * s7;
-        component[i*8 + 3] = g7 * s3;
-    }
-
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 8; ++j) {
-            result[i][j] = round(component[i * 8 + j] + 0.5f); // Round to nearest int
-        }
-    }
+// dct2OnBlock()
+// Description: Applies DCT II to a single 8x8 block using the selected DCT kernel and mode
+// Input: const coefficient *block - 64 samples in row-major order
+//        coefficient *result - 64 DCT coefficients in row-major order
+// Output: No return value, modifies the result block
+void JpegImage::dct2OnBlock(const coefficient* block, coefficient* result) {
+    forwardDctBlocks(block, result, 1, dctKernel, dctMode);
 }
 
-void JpegImage::idct2OnBlock(int** block, int** result) {
-    static const float m0 = 2.0 * cos(1.0/16.0 * 2.0 * M_PI);
-    static const float m1 = 2.0 * cos(2.0/16.0 * 2.0 * M_PI);
-    static const float m3 = 2.0 * cos(2.0/16.0 * 2.0 * M_PI);
-    static const float m5 = 2.0 * cos(3.0/16.0 * 2.0 * M_PI);
-    static const float m2 = m0-m5;
-    static const float m4 = m0+m5;
-
-    static const float s0 = cos(0.0/16.0 *M_PI)/sqrt(8);
-    static const float s1 = cos(1.0/16.0 *M_PI)/2.0;
-    static const float s2 = cos(2.0/16.0 *M_PI)/2.0;
-    static const float s3 = cos(3.0/16.0 *M_PI)/2.0;
-    static const float s4 = cos(4.0/16.0 *M_PI)/2.0;
-    static const float s5 = cos(5.0/16.0 *M_PI)/2.0;
-    static const float s6 = cos(6.0/16.0 *M_PI)/2.0;
-    static const float s7 = cos(7.0/16.0 *M_PI)/2.0;
-
-    float component[64]; // Temporary array to store the floating-point version of the block
-
-    // Convert the int** input to a float* component
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 8; ++j) {
-            component[i * 8 + j] = static_cast<float>(block[i][j]);
-        }
-    }
-
-    for(int i = 0; i < 8; i++)
-    {
-        const float g0 = component[0*8 + i] * s0;
-        const float g1 = component[4*8 + i] * s4;
-        const float g2 = component[2*8 + i] * s2;
-        const float g3 = component[6*8 + i] * s6;
-        const float g4 = component[5*8 + i] * s5;
-        const float g5 = component[1*8 + i] * s1;
-        const float g6 = component[7*8 + i] * s7;
-        const float g7 = component[3*8 + i] * s3;
-
-        const float f0 = g0;
-        const float f1 = g1;
-        const float f2 = g2;
-        const float f3 = g3;
-        const float f4 = g4 - g7;
-        const float f5 = g5 + g6;
-        const float f6 = g5 - g6;
-        const float f7 = g4 + g7;
-
-        const float e0 = f0;
-        const float e1 = f1;
-        const float e2 = f2 - f3;
-        const float e3 = f2 + f3;
-        const float e4 = f4;
-        const float e5 = f5 - f7;
-        const float e6 = f6;
-        const float e7 = f5 + f7;
-        const float e8 = f4 + f6;
-
-        const float d0 = e0;
-        const float d1 = e1;
-        const float d2 = e2 * m1;
-        const float d3 = e3;
-        const float d4 = e4 * m2;
-        const float d5 = e5 * m3;
-        const float d6 = e6 * m4;
-        const float d7 = e7;
-        const float d8 = e8 * m5;
-
-        const float c0 = d0 + d1;
-        const float c1 = d0 - d1;
-        const float c2 = d2 - d3;
-        const float c3 = d3;
-        const float c4 = d4 + d8;
-        const float c5 = d5 + d7;
-        const float c6 = d6 - d8;
-        const float c7 = d7;
-        const float c8 = c5 - c6;
-
-        const float b0 = c0 + c3;
-        const float b1 = c1 + c2;
-        const float b2 = c1 - c2;
-        const float b3 = c0 - c3;
-        const float b4 = c4 - c8;
-        const float b5 = c8;
-        const float b6 = c6 - c7;
-        const float b7 = c7;
-
-        component[0 * 8 + i] = b0 + b7;
-        component[1 * 8 + i] = b1 + b6;
-        component[2 * 8 + i] = b2 + b5;
-        component[3 * 8 + i] = b3 + b4;
-        component[4 * 8 + i] = b3 - b4;
-        component[5 * 8 + i] = b2 - b5;
-        component[6 * 8 + i] = b1 - b6;
-        component[7 * 8 + i] = b0 - b7;
-    }
-
-    for(int i = 0 ; i < 8; i++)
-    {
-        const float g0 = component[i*8 + 0] * s0;
-        const float g1 = component[i*8 + 4] * s4;
-        const float g2 = component[i*8 + 2] * s2;
-        const float g3 = component[i*8 + 6] * s6;
-        const float g4 = component[i*8 + 5] * s5;
-        const float g5 = component[i*8 + 1] * s1;
-        const float g6 = component[i*8 + 7] * s7;
-        const float g7 = component[i*8 + 3] * s3;
-
-        const float f0 = g0;
-        const float f1 = g1;
-        const float f2 = g2;
-        const float f3 = g3;
-        const float f4 = g4 - g7;
-        const float f5 = g5 + g6;
-        const float f6 = g5 - g6;
-        const float f7 = g4 + g7;
-
-        const float e0 = f0;
-        const float e1 = f1;
-        const float e2 = f2 - f3;
-        const float e3 = f2 + f3;
-        const float e4 = f4;
-        const float e5 = f5 - f7;
-        const float e6 = f6;
-        const float e7 = f5 + f7;
-        const float e8 = f4 + f6;
-
-        const float d0 = e0;
-        const float d1 = e1;
-        const float d2 = e2 * m1;
-        const float d3 = e3;
-        const float d4 = e4 * m2;
-        const float d5 = e5 * m3;
-        const float d6 = e6 * m4;
-        const float d7 = e7;
-        const float d8 = e8 * m5;
-
-        const float c0 = d0 + d1;
-        const float c1 = d0 - d1;
-        const float c2 = d2 - d3;
-        const float c3 = d3;
-        const float c4 = d4 + d8;
-        const float c5 = d5 + d7;
-        const float c6 = d6 - d8;
-        const float c7 = d7;
-        const float c8 = c5 - c6;
-
-        const float b0 = c0 + c3;
-        const float b1 = c1 + c2;
-        const float b2 = c1 - c2;
-        const float b3 = c0 - c3;
-        const float b4 = c4 - c8;
-        const float b5 = c8;
-        const float b6 = c6 - c7;
-        const float b7 = c7;
-
-        component[i * 8 + 0] = b0 + b7;
-        component[i * 8 + 1] = b1 + b6;
-        component[i * 8 + 2] = b2 + b5;
-        component[i * 8 + 3] = b3 + b4;
-        component[i * 8 + 4] = b3 - b4;
-        component[i * 8 + 5] = b2 - b5;
-        component[i * 8 + 6] = b1 - b6;
-        component[i * 8 + 7] = b0 - b7;
-    }
-
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 8; ++j) {
-            result[i][j] = round(component[i * 8 + j] + 0.5f); // Round to nearest int
-        }
-    }
+// idct2OnBlock()
+// Description: Applies inverse DCT II to a single 8x8 block using the selected DCT kernel and mode
+// Input: const coefficient *block - 64 DCT coefficients in row-major order
+//        coefficient *result - 64 samples in row-major order
+// Output: No return value, modifies the result block
+void JpegImage::idct2OnBlock(const coefficient* block, coefficient* result) {
+    inverseDctBlocks(block, result, 1, dctKernel, dctMode);
 }
 
 // dct2OnAllBlockChannels()
@@ -778,10 +1134,10 @@ void JpegImage::idct2OnBlock(int** block, int** result) {
 // Input: DCTBlock input - input block with Y, Cb, and Cr channels
 //        DCTBlock output - output block with Y, Cb, and Cr channels
 // Output: No return value, modifies the output DCTBlock
-void JpegImage::dct2OnAllBlockChannels(DCTBlock *input, DCTBlock *output) {
-    dct2OnBlock(input->Y, output->Y);
-    dct2OnBlock(input->Cb, output->Cb);
-    dct2OnBlock(input->Cr, output->Cr);
+void JpegImage::dct2OnAllBlockChannels(const DCTBlock &input, const DCTBlock &output) {
+    dct2OnBlock(input.Y, output.Y);
+    dct2OnBlock(input.Cb, output.Cb);
+    dct2OnBlock(input.Cr, output.Cr);
 }
 
 // idct2OnAllBlockChannels()
@@ -789,271 +1145,271 @@ void JpegImage::dct2OnAllBlockChannels(DCTBlock *input, DCTBlock *output) {
 // Input: DCTBlock input - input block with Y, Cb, and Cr channels
 //        DCTBlock output - output block with Y, Cb, and Cr channels
 // Output: No return value, modifies the output DCTBlock
-void JpegImage::idct2OnAllBlockChannels(DCTBlock *input, DCTBlock *output) {
-    idct2OnBlock(input->Y, output->Y);
-    idct2OnBlock(input->Cb, output->Cb);
-    idct2OnBlock(input->Cr, output->Cr);
-}
-
-DCTBlock* JpegImage::allocateDCTBlock() {
-    DCTBlock* block = new DCTBlock;
-    block->Y = allocateMatrix(8, 8);
-    block->Cb = allocateMatrix(8, 8);
-    block->Cr = allocateMatrix(8, 8);
-    return block;
-}
-
-int** JpegImage::allocateMatrix(int rows, int cols) {
-    int** matrix = new int*[rows];
-    for(int i = 0; i < rows; ++i) {
-        matrix[i] = new int[cols];
-        fill_n(matrix[i], cols, 0); // Initialize all elements to 0
-    }
-    return matrix;
-}
-
-void JpegImage::deallocateMatrix(int** matrix, int rows) {
-    for(int i = 0; i < rows; ++i) {
-        delete[] matrix[i];
-    }
-    delete[] matrix;
-}
-
-void JpegImage::deallocateDCTBlock(DCTBlock* block) {
-    deallocateMatrix(block->Y, 8);
-    deallocateMatrix(block->Cb, 8);
-    deallocateMatrix(block->Cr, 8);
-    delete block;
+void JpegImage::idct2OnAllBlockChannels(const DCTBlock &input, const DCTBlock &output) {
+    idct2OnBlock(input.Y, output.Y);
+    idct2OnBlock(input.Cb, output.Cb);
+    idct2OnBlock(input.Cr, output.Cr);
 }
 
-
 // generateDCTBlocks()
 // Description: Splits the image into 8x8 blocks and applies DCT II to each block
-// Input: No parameters, operates on the pixelsYCbCr 2D vector attribute
-// Output: No return value, returns through the dctBlocks 2D vector attribute
+// Input: No parameters, operates on the pixelsYCbCr buffer attribute
+// Output: No return value, returns through the dctBlocks coefficient store
 void JpegImage::generateDCTBlocks() {
     if (!ycbcrLoaded) {
         cout << "No YCbCr data loaded - JpegImage::generateDCTBlocks" << endl;
         return;
     }
 
-    // Resizing the dctBlocks 2D vector to represent 2D vector of 8x8 blocks of the pixels
-    this->dctBlocks.resize(height / 8);
-    for (int i = 0; i < height / 8; i++) {
-        this->dctBlocks[i].resize(width / 8);
+    transformPixelBlocks(dctBlocks, false);
+    dctBlocksGenerated = true;
+}
+
+// generateQuantizedDCTBlocks()
+// Description: Applies DCT II to each 8x8 block and quantizes the coefficients as the DCT stores
+//              them, skipping the intermediate dctBlocks store
+// Input: No parameters, operates on the pixelsYCbCr buffer attribute
+// Output: No return value, returns through the quantizedBlocks coefficient store
+void JpegImage::generateQuantizedDCTBlocks() {
+    if (!ycbcrLoaded) {
+        cout << "No YCbCr data loaded - JpegImage::generateQuantizedDCTBlocks" << endl;
+        return;
     }
 
-    // Allocate memory for DCT Block
-    DCTBlock* inputBlock = allocateDCTBlock();
+    transformPixelBlocks(quantizedBlocks, true);
+    quantizedBlocksGenerated = true;
+}
 
-    // Applying DCT II to each 8x8 block
-    for (int i = 0; i < height; i += 8) {
-        for (int j = 0; j < width; j += 8) {
-            // Fill in the block with Y, Cb, and Cr values
-            for (int x = 0; x < 8; x++) {
-                for (int y = 0; y < 8; y++) {
-                    inputBlock->Y[x][y] = pixelsYCbCr[i + x][j + y].y;
-                    inputBlock->Cb[x][y] = pixelsYCbCr[i + x][j + y].cb;
-                    inputBlock->Cr[x][y] = pixelsYCbCr[i + x][j + y].cr;
+// transformPixelBlocks()
+// Description: Splits the image into 8x8 blocks and applies DCT II to each block, optionally
+//              quantizing the coefficients in the DCT's final stage. Subsampled chroma blocks are
+//              box-filtered from the pixels as they are staged
+// Input: CoefficientStore &output - store receiving the coefficients
+//        bool quantize - whether to quantize with the channel quantization tables
+// Output: No return value, modifies the output store
+void JpegImage::transformPixelBlocks(CoefficientStore &output, bool quantize) {
+    // Number of horizontally adjacent blocks handed to the DCT kernel in one call
+    const int batchSize = 8;
+
+    // Allocating one coefficient plane per channel, chroma at the resolution of the subsampling mode
+    output.allocate(height / 8, width / 8, hSamplingFactor(), vSamplingFactor());
+    const int rows = output.rows();
+    const int cols = output.cols();
+    const int h = output.hSampling();
+    const int v = output.vSampling();
+    const bool subsampled = output.subsampled();
+
+    // Last pixel row and column under the luma blocks, chroma samples past them repeat the edge
+    const int lastRow = rows * 8 - 1;
+    const int lastCol = cols * 8 - 1;
+
+    // Applying DCT II to each row of MCUs, one batch of blocks at a time. Every thread takes a range
+    // of MCU rows and writes only to those rows of the planes, so the output is the same for any
+    // thread count
+    forEachRow(output.mcuRows(), [&](int first, int last) {
+        // Staging buffers holding the Y, Cb, and Cr samples of the current batch of blocks
+        alignas(64) coefficient samples[3][batchSize * 64];
+
+        for (int m = first; m < last; m++) {
+            // Luma block rows of the MCU row, full resolution chroma staged along with them
+            const int channels = subsampled ? 1 : 3;
+            for (int i = m * v; i < min(rows, (m + 1) * v); i++) {
+                for (int j = 0; j < cols; j += batchSize) {
+                    int count = min(batchSize, cols - j);
+
+                    // Fill in the batch with Y values, and Cb and Cr values unless they are subsampled
+                    for (int b = 0; b < count; b++) {
+                        for (int x = 0; x < 8; x++) {
+                            const ycbcr *row = &pixelsYCbCr[i * 8 + x][(j + b) * 8];
+                            for (int y = 0; y < 8; y++) {
+                                samples[Y][b * 64 + x * 8 + y] = row[y].y;
+                            }
+                            if (subsampled) {
+                                continue;
+                            }
+                            for (int y = 0; y < 8; y++) {
+                                samples[Cb][b * 64 + x * 8 + y] = row[y].cb;
+                                samples[Cr][b * 64 + x * 8 + y] = row[y].cr;
+                            }
+                        }
+                    }
+
+                    // Blocks of a row are contiguous in each plane, so the whole batch is written in place
+                    for (int k = 0; k < channels; k++) {
+                        const QuantTable *quant = quantize ? &channelQuantTable(k) : nullptr;
+                        forwardDctBlocks(samples[k], output.channel(k, i, j), count, dctKernel, dctMode, quant);
+                    }
                 }
             }
 
-            // Allocate memory for output DCT block
-            DCTBlock* outputBlock = allocateDCTBlock();
-
-            // Apply DCT II to the block
-            dct2OnAllBlockChannels(inputBlock, outputBlock);
+            if (!subsampled) {
+                continue;
+            }
 
-            dctBlocks[i / 8][j / 8] = outputBlock;
+            // Chroma block row of the MCU row, each sample the rounded mean of the h x v pixels under it
+            const int chromaCols = output.planeCols(Cb);
+            for (int j = 0; j < chromaCols; j += batchSize) {
+                int count = min(batchSize, chromaCols - j);
+
+                for (int b = 0; b < count; b++) {
+                    for (int x = 0; x < 8; x++) {
+                        for (int y = 0; y < 8; y++) {
+                            int sumCb = 0;
+                            int sumCr = 0;
+                            for (int dy = 0; dy < v; dy++) {
+                                const ycbcr *row = pixelsYCbCr[min(lastRow, (m * 8 + x) * v + dy)];
+                                for (int dx = 0; dx < h; dx++) {
+                                    const ycbcr &pixel = row[min(lastCol, ((j + b) * 8 + y) * h + dx)];
+                                    sumCb += pixel.cb;
+                                    sumCr += pixel.cr;
+                                }
+                            }
+                            samples[Cb][b * 64 + x * 8 + y] = (sumCb + h * v / 2) / (h * v);
+                            samples[Cr][b * 64 + x * 8 + y] = (sumCr + h * v / 2) / (h * v);
+                        }
+                    }
+                }
 
+                for (int k = Cb; k <= Cr; k++) {
+                    const QuantTable *quant = quantize ? &channelQuantTable(k) : nullptr;
+                    forwardDctBlocks(samples[k], output.channel(k, m, j), count, dctKernel, dctMode, quant);
+                }
+            }
         }
-    }
-
-    // Deallocate memory for input DCT block
-    deallocateDCTBlock(inputBlock);
-
-    dctBlocksGenerated = true;
+    });
 }
 
 // invertDCTBlocks()
 // Description: Converts DCT blocks to pixel data (YCbCr)
-// Input: No parameters, operates on the dctBlocks 2D vector attribute
-// Output: No return value, modifies the pixelsYCbCr 2D vector attribute
+// Input: No parameters, operates on the dctBlocks coefficient store
+// Output: No return value, modifies the pixelsYCbCr buffer attribute
 void JpegImage::invertDCTBlocks() {
     if (!dctBlocksGenerated) {
         cout << "No DCT blocks generated - JpegImage::invertDCTBlocks()" << endl;
         return;
     }
 
-    // Resizing the pixelsYCbCr 2D vector to represent 2D vector of YCbCr pixels
-    this->pixelsYCbCr.resize(height);
-
-    for (int i = 0; i < height; i++) {
-        this->pixelsYCbCr[i].resize(width);
-    }
-
-    // DCT Input block pointer
-    DCTBlock* inputBlock;
-
-    // Allocate memory for output DCT block
-    DCTBlock* outputBlock = allocateDCTBlock();
-
-    // Applying inverse DCT II to each 8x8 block
-    for (int i = 0; i < height; i += 8) {
-        for (int j = 0; j < width; j += 8) {
-            // Allocate memory for DCT Block
-            inputBlock = dctBlocks[i / 8][j / 8];
+    // Allocating the pixelsYCbCr buffer (pixels past the last whole block stay zero)
+    this->pixelsYCbCr.allocate(width, height);
+
+    // Applying inverse DCT II to each row of MCUs (DC-only and sparse blocks take the fast paths),
+    // every thread taking a range of MCU rows. Subsampled chroma is upsampled as the pixels are
+    // filled in, each chroma sample covering the h x v pixels it was averaged from
+    const int rows = dctBlocks.rows();
+    const int cols = dctBlocks.cols();
+    const int v = dctBlocks.vSampling();
+    const int hShift = dctBlocks.hSampling() - 1;
+    const int vShift = v - 1;
+    forEachRow(dctBlocks.mcuRows(), [&](int first, int last) {
+        // Staging rows receiving the inverse DCT of the current row of blocks of each channel
+        AlignedBuffer<coefficient> samples[3];
+        for (int k = 0; k < 3; k++) {
+            samples[k].allocate(dctBlocks.planeCols(k) * 64);
+        }
 
-            // Apply inverse DCT II to the block
-            idct2OnAllBlockChannels(inputBlock, outputBlock);
+        for (int m = first; m < last; m++) {
+            for (int k = Cb; k <= Cr; k++) {
+                inverseDctBlocks(dctBlocks.channel(k, m, 0), samples[k].data(), dctBlocks.planeCols(k), dctKernel, dctMode);
+            }
 
-            // Fill in the pixelsYCbCr 2D vector with the output block values
-            for (int x = 0; x < 8; x++) {
-                for (int y = 0; y < 8; y++) {
-                    pixelsYCbCr[i + x][j + y].y = min(max(16, outputBlock->Y[x][y]), 255);
-                    pixelsYCbCr[i + x][j + y].cb = min(max(16, outputBlock->Cb[x][y]), 255);
-                    pixelsYCbCr[i + x][j + y].cr = min(max(16, outputBlock->Cr[x][y]), 255);
+            for (int i = m * v; i < min(rows, (m + 1) * v); i++) {
+                inverseDctBlocks(dctBlocks.channel(Y, i, 0), samples[Y].data(), cols, dctKernel, dctMode);
+
+                // Fill in the pixelsYCbCr buffer with the output block values
+                for (int j = 0; j < cols; j++) {
+                    const coefficient *blockY = &samples[Y][j * 64];
+                    for (int x = 0; x < 8; x++) {
+                        ycbcr *row = &pixelsYCbCr[i * 8 + x][j * 8];
+
+                        // Chroma row of this pixel row within the chroma block row
+                        const int chromaX = ((i * 8 + x) >> vShift) & 7;
+                        for (int y = 0; y < 8; y++) {
+                            const int chromaY = (j * 8 + y) >> hShift;
+                            const int chroma = (chromaY >> 3) * 64 + chromaX * 8 + (chromaY & 7);
+                            row[y].y = min(max(16, blockY[x * 8 + y]), 255);
+                            row[y].cb = min(max(16, samples[Cb][chroma]), 255);
+                            row[y].cr = min(max(16, samples[Cr][chroma]), 255);
+                        }
+                    }
                 }
             }
         }
-    }
-
-    // Deallocate memory for input DCT block
-    deallocateDCTBlock(outputBlock);
+    });
 
     ycbcrLoaded = true;
 }
 
 // quantizeBlock()
 // Description: Quantizes an 8x8 block using the quantization tables
-// Input: int **block - 8x8 block to quantize
+// Input: coefficient *block - 8x8 block (64 contiguous coefficients) to quantize
 //        Channel channel - channel to use for quantization
 // Output: No return value, modifies the input block
-void JpegImage::quantizeBlock(int **block, Channel channel) {
-    // Variable declaration
-    int i, j;
-    int tableVal;
-
-    // Quantizing the block
-    for (i = 0; i < 8; i++) {
-        for (j = 0; j < 8; j++) {
-            tableVal = (channel == Y) ? quantTables.luminance[i][j] : quantTables.chrominance[i][j];
-            block[i][j] = round(block[i][j] / tableVal);
-        }
-    }
+void JpegImage::quantizeBlock(coefficient *block, Channel channel) {
+    quantizeCoefficients(block, block, 1, channelQuantTable(channel));
 }
 
 // dequantizeBlock()
 // Description: Dequantizes an 8x8 block using the quantization tables
-// Input: int **block - 8x8 block to dequantize
+// Input: coefficient *block - 8x8 block (64 contiguous coefficients) to dequantize
 //        Channel channel - channel to use for dequantization
 // Output: No return value, modifies the input block
-void JpegImage::dequantizeBlock(int **block, Channel channel) {
-    // Variable declaration
-    int i, j;
-    int tableVal;
-
-    // Quantizing the block
-    for (i = 0; i < 8; i++) {
-        for (j = 0; j < 8; j++) {
-            tableVal = (channel == Y) ? quantTables.luminance[i][j] : quantTables.chrominance[i][j];
-            block[i][j] = round(block[i][j] * tableVal);
-        }
-    }
+void JpegImage::dequantizeBlock(coefficient *block, Channel channel) {
+    dequantizeCoefficients(block, block, 1, channelQuantTable(channel));
 }
 
 // generateQuantizedBlocks()
 // Description: Quantizes all DCT blocks
-// Input: No parameters, operates on the dctBlocks 2D vector attribute
-// Output: No return value, modifies the quantizedBlocks 2D vector attribute
+// Input: No parameters, operates on the dctBlocks coefficient store
+// Output: No return value, modifies the quantizedBlocks coefficient store
 void JpegImage::generateQuantizedBlocks() {
     if (!dctBlocksGenerated) {
         cout << "No DCT blocks generated - JpegImage::generateQuantizedBlocks" << endl;
         return;
     }
 
-    // Resizing the quantizedBlocks 2D vector to represent 2D vector of 8x8 blocks of the pixels
-    this->quantizedBlocks.resize(height / 8);
-    for (int i = 0; i < height / 8; i++) {
-        this->quantizedBlocks[i].resize(width / 8);
-    }
-
-    // Quantizing all DCT blocks
-    for (int i = 0; i < height / 8; i++) {
-        for (int j = 0; j < width / 8; j++) {
-            // Allocate memory for quantized DCT Block
-            DCTBlock* quantizedBlock = allocateDCTBlock();
-
-            // Copy the DCT block to the quantized block
-            for (int x = 0; x < 8; x++) {
-                for (int y = 0; y < 8; y++) {
-                    quantizedBlock->Y[x][y] = dctBlocks[i][j]->Y[x][y];
-                    quantizedBlock->Cb[x][y] = dctBlocks[i][j]->Cb[x][y];
-                    quantizedBlock->Cr[x][y] = dctBlocks[i][j]->Cr[x][y];
-                }
-            }
-
-            // Quantize the block
-            quantizeBlockChannels(quantizedBlock);
-
-            quantizedBlocks[i][j] = quantizedBlock;
+    // Quantizing each DCT coefficient plane straight into the quantized plane, the block rows of a
+    // range of MCU rows (contiguous in every plane) per thread
+    quantizedBlocks.allocate(dctBlocks.rows(), dctBlocks.cols(), dctBlocks.hSampling(), dctBlocks.vSampling());
+    forEachRow(dctBlocks.mcuRows(), [this](int first, int last) {
+        for (int k = 0; k < 3; k++) {
+            const int v = k == Y ? dctBlocks.vSampling() : 1;
+            const int rowEnd = min(dctBlocks.planeRows(k), last * v);
+            const int count = (rowEnd - first * v) * dctBlocks.planeCols(k);
+            quantizeCoefficients(dctBlocks.channel(k, first * v, 0), quantizedBlocks.channel(k, first * v, 0), count, channelQuantTable(k));
         }
-    }
+    });
 
     quantizedBlocksGenerated = true;
 }
 
 // invertQuantizedBlocks()
 // Description: Dequantizes all quantized DCT blocks
-// Input: No parameters, operates on the quantizedBlocks 2D vector attribute
-// Output: No return value, modifies the dctBlocks 2D vector attribute
+// Input: No parameters, operates on the quantizedBlocks coefficient store
+// Output: No return value, modifies the dctBlocks coefficient store
 void JpegImage::dequantizeBlocks() {
     if (!quantizedBlocksGenerated) {
         cout << "No quantized DCT blocks generated - JpegImage::dequantizeBlocks()" << endl;
         return;
     }
 
-    // Resizing the dctBlocks 2D vector to represent 2D vector of 8x8 blocks of the pixels
-    this->dctBlocks.resize(height / 8);
-    for (int i = 0; i < height / 8; i++) {
-        this->dctBlocks[i].resize(width / 8);
-    }
-
-    // Dequantizing all quantized DCT blocks
-    for (int i = 0; i < height / 8; i++) {
-        for (int j = 0; j < width / 8; j++) {
-            DCTBlock* dctBlock;
-            // If the dct blocks were previously allocated, use the same memory
-            if (dctBlocksGenerated) {
-                dctBlock = dctBlocks[i][j];
-            } else {
-                // Allocate memory for DCT Block
-                dctBlock = allocateDCTBlock();
-            }
-
-
-            // Copy the quantized block to the DCT block
-            for (int x = 0; x < 8; x++) {
-                for (int y = 0; y < 8; y++) {
-                    dctBlock->Y[x][y] = quantizedBlocks[i][j]->Y[x][y];
-                    dctBlock->Cb[x][y] = quantizedBlocks[i][j]->Cb[x][y];
-                    dctBlock->Cr[x][y] = quantizedBlocks[i][j]->Cr[x][y];
-                }
-            }
-
-            // Dequantize the block
-            dequantizeBlockChannels(dctBlock);
-
-            dctBlocks[i][j] = dctBlock;
+    // Dequantizing each quantized plane straight into the DCT plane (reused if previously allocated),
+    // the block rows of a range of MCU rows per thread
+    dctBlocks.allocate(quantizedBlocks.rows(), quantizedBlocks.cols(), quantizedBlocks.hSampling(), quantizedBlocks.vSampling());
+    forEachRow(quantizedBlocks.mcuRows(), [this](int first, int last) {
+        for (int k = 0; k < 3; k++) {
+            const int v = k == Y ? quantizedBlocks.vSampling() : 1;
+            const int rowEnd = min(quantizedBlocks.planeRows(k), last * v);
+            const int count = (rowEnd - first * v) * quantizedBlocks.planeCols(k);
+            dequantizeCoefficients(quantizedBlocks.channel(k, first * v, 0), dctBlocks.channel(k, first * v, 0), count, channelQuantTable(k));
         }
-    }
+    });
 
     dctBlocksGenerated = true;
 }
 
 // zigzag()
 // Description: Converts DCT quantized blocks to a zigzag sequence
-// Input: No parameters, operates on the dctBlocks 2D vector attribute
+// Input: No parameters, operates on the quantizedBlocks coefficient store
 void JpegImage::zigzag(vector<int> &sequence) {
     // Checking if quantized blocks are generated
     if (!quantizedBlocksGenerated) {
@@ -1061,21 +1417,33 @@ void JpegImage::zigzag(vector<int> &sequence) {
         return;
     }
 
-    // Looping over all DCT blocks
-    for (int i = 0; i < height / 8; i++) {
-        for (int j = 0; j < width / 8; j++) {
-            // Convert DCT block to zigzag sequence
-            zigzagDCTBlock(quantizedBlocks[i][j], sequence);
+    // Every block has a fixed slot of 64 * 3 values, so the sequence is sized up front and each
+    // thread fills in the slots of its block rows
+    const size_t start = sequence.size();
+    const int cols = width / 8;
+    sequence.resize(start + (size_t)(height / 8) * cols * 64 * 3);
+
+    forEachRow(height / 8, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            for (int j = 0; j < cols; j++) {
+                int *slot = sequence.data() + start + ((size_t)i * cols + j) * 64 * 3;
+                for (int k = 0; k < 3; k++) {
+                    const coefficient *block = quantizedBlocks.channel(k, i, j);
+                    for (int z = 0; z < 64; z++) {
+                        slot[k * 64 + z] = block[zigzagOrder[z][0] * 8 + zigzagOrder[z][1]];
+                    }
+                }
+            }
         }
-    }
+    });
 }
 
 // zigzagBlock()
 // Description: Converts an 8x8 block to a zigzag sequence
-// Input: int **block - 8x8 block to convert
+// Input: const coefficient *block - 8x8 block to convert
 //        vector<int> &sequence - reference to the sequence to store the zigzag values
 // Output: No return value, modifies the sequence
-void JpegImage::zigzagBlock(int **block, vector<int> &sequence) {
+void JpegImage::zigzagBlock(const coefficient *block, vector<int> &sequence) {
     // Variable declaration
     int x, y;
 
@@ -1083,43 +1451,37 @@ void JpegImage::zigzagBlock(int **block, vector<int> &sequence) {
     for (int i = 0; i < 64; i++) {
         x = zigzagOrder[i][0];
         y = zigzagOrder[i][1];
-        sequence.push_back(block[x][y]);
+        sequence.push_back(block[x * 8 + y]);
     }
 }
 
 // zigzagDCTBlock()
 // Description: Converts a DCT block to a zigzag sequence
-// Input: DCTBlock *block - block to convert
+// Input: const DCTBlock &block - block to convert
 //        vector<int> &sequence - reference to the sequence to store the zigzag values
 // Output: No return value, modifies the sequence
-void JpegImage::zigzagDCTBlock(DCTBlock *block, vector<int> &sequence) {
-    zigzagBlock(block->Y, sequence);
-    zigzagBlock(block->Cb, sequence);
-    zigzagBlock(block->Cr, sequence);
+void JpegImage::zigzagDCTBlock(const DCTBlock &block, vector<int> &sequence) {
+    zigzagBlock(block.Y, sequence);
+    zigzagBlock(block.Cb, sequence);
+    zigzagBlock(block.Cr, sequence);
 }
 
 // inverseZigzag()
 // Description: Converts a zigzag sequence to DCT quantized blocks
 // Input: vector<int> &sequence - sequence to convert
-// Output: No return value, modifies the quantizedBlocks 2D vector attribute
+// Output: No return value, modifies the quantizedBlocks coefficient store
 void JpegImage::inverseZigzag(vector<int> &sequence) {
-    // If quantized blocks not yet allocated, allocate memory
-    if (!quantizedBlocksGenerated) {
-        quantizedBlocks.resize(height / 8);
-        for (int i = 0; i < height / 8; i++) {
-            quantizedBlocks[i].resize(width / 8);
-        }
-    }
-
-    int start_index = 0;
-    for (int i = 0; i < height / 8; i++) {
-        for (int j = 0; j < width / 8; j++) {
-            DCTBlock* block = allocateDCTBlock();
-            inverseZigzagDCTBlock(sequence, block, start_index);
-            start_index += 64 * 3;
-            quantizedBlocks[i][j] = block;
+    // Allocating zeroed coefficient planes, so blocks missing from the sequence stay empty
+    quantizedBlocks.allocate(height / 8, width / 8);
+
+    const int cols = width / 8;
+    forEachRow(height / 8, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            for (int j = 0; j < cols; j++) {
+                inverseZigzagDCTBlock(sequence, quantizedBlocks.block(i, j), (i * cols + j) * 64 * 3);
+            }
         }
-    }
+    });
 
     quantizedBlocksGenerated = true;
 }
@@ -1127,10 +1489,10 @@ void JpegImage::inverseZigzag(vector<int> &sequence) {
 // inverseZigzagBlock()
 // Description: Converts a zigzag sequence to an 8x8 block
 // Input: vector<int> &sequence - sequence to convert
-//        int **block - 8x8 block to store the values
+//        coefficient *block - 8x8 block to store the values
 //        int start_index - starting index of the sequence
 // Output: No return value, modifies the block
-void JpegImage::inverseZigzagBlock(vector<int> &sequence, int **block, int start_index) {
+void JpegImage::inverseZigzagBlock(vector<int> &sequence, coefficient *block, int start_index) {
     bool outOfBounds = false;
     for (int i = 0; i < 64 && !outOfBounds; i++) {
         int x = zigzagOrder[i][0];
@@ -1142,7 +1504,7 @@ void JpegImage::inverseZigzagBlock(vector<int> &sequence, int **block, int start
             outOfBounds = true;
         } else {
             int sequence_item = sequence[start_index + i];
-            block[x][y] = sequence_item;
+            block[x * 8 + y] = sequence_item;
         }
     }
 }
@@ -1150,33 +1512,33 @@ void JpegImage::inverseZigzagBlock(vector<int> &sequence, int **block, int start
 // inverseZigzagDCTBlock()
 // Description: Converts a zigzag sequence to a DCT block
 // Input: vector<int> &sequence - sequence to convert
-//        DCTBlock *block - block to store the values
+//        const DCTBlock &block - block to store the values
 //        int start_index - starting index of the sequence
 // Output: No return value, modifies the block
-void JpegImage::inverseZigzagDCTBlock(vector<int> &sequence, DCTBlock *block, int start_index) {
-    inverseZigzagBlock(sequence, block->Y, start_index);
-    inverseZigzagBlock(sequence, block->Cb, start_index + 64);
-    inverseZigzagBlock(sequence, block->Cr, start_index + 128);
+void JpegImage::inverseZigzagDCTBlock(vector<int> &sequence, const DCTBlock &block, int start_index) {
+    inverseZigzagBlock(sequence, block.Y, start_index);
+    inverseZigzagBlock(sequence, block.Cb, start_index + 64);
+    inverseZigzagBlock(sequence, block.Cr, start_index + 128);
 }
 
 // quantizeBlockChannels()
 // Description: Quantizes the Y, Cb, and Cr channels of a DCT block
-// Input: DCTBlock *block - block to quantize
+// Input: const DCTBlock &block - block to quantize
 // Output: No return value, modifies the input block
-void JpegImage::quantizeBlockChannels(DCTBlock *block) {
-    quantizeBlock(block->Y, Y);
-    quantizeBlock(block->Cb, Cb);
-    quantizeBlock(block->Cr, Cr);
+void JpegImage::quantizeBlockChannels(const DCTBlock &block) {
+    quantizeBlock(block.Y, Y);
+    quantizeBlock(block.Cb, Cb);
+    quantizeBlock(block.Cr, Cr);
 }
 
 // dequantizeBlockChannels()
 // Description: Dequantizes the Y, Cb, and Cr channels of a DCT block
-// Input: DCTBlock *block - block to dequantize
+// Input: const DCTBlock &block - block to dequantize
 // Output: No return value, modifies the input block
-void JpegImage::dequantizeBlockChannels(DCTBlock *block) {
-    dequantizeBlock(block->Y, Y);
-    dequantizeBlock(block->Cb, Cb);
-    dequantizeBlock(block->Cr, Cr);
+void JpegImage::dequantizeBlockChannels(const DCTBlock &block) {
+    dequantizeBlock(block.Y, Y);
+    dequantizeBlock(block.Cb, Cb);
+    dequantizeBlock(block.Cr, Cr);
 }
 
 // setQuantizationTables()
@@ -1229,6 +1591,10 @@ void JpegImage::setQuantizationTables(int quality) {
         }
     }
 
+    // Precomputing the per-channel reciprocals used by quantization
+    buildQuantTable(quantTables.luminance, channelQuantTables[0]);
+    buildQuantTable(quantTables.chrominance, channelQuantTables[1]);
+
     // Precomputing Cm, Cn, cosX, cosY for faster DCT-II implementation
     for (int m = 0; m < M; ++m) {
         Cm[m] = (m == 0) ? sqrt(1.0 / M) : sqrt(2.0 / M);
@@ -1280,7 +1646,8 @@ void JpegImage::decodeRLE(vector<int> &input, vector<int> &output, int size) {
         return;
     }
 
-    for (int i = 0; i < input.size(); i++) {
+    // Stopping at the last complete (value, count) pair
+    for (int i = 0; i + 1 < input.size(); i++) {
         int value = input[i];
         int count = input[++i];
 
@@ -1336,70 +1703,89 @@ HuffmanNode* JpegImage::buildHuffmanTree(const map<int, int>& frequencies) {
 // generateHuffmanCodes()
 // Description: Generates Huffman codes for each value in a Huffman tree
 // Input: HuffmanNode* root - root of the Huffman tree
-// Output: map<int, string> - map of value to Huffman code
-map<int, string> JpegImage::generateHuffmanCodes(const HuffmanNode* root) {
-    map<int, string> huffmanCodes;
-    generateHuffmanCodesRecursive(root, "", huffmanCodes);
+// Output: HuffmanCodeTable - flat table of value to Huffman code
+HuffmanCodeTable JpegImage::generateHuffmanCodes(const HuffmanNode* root) {
+    // Trees of the encoder's own counts (less than 2^32 in total) are at most 46 levels deep
+    vector<pair<int, HuffmanCode>> leaves;
+    generateHuffmanCodesRecursive(root, 0, 0, leaves);
+
+    HuffmanCodeTable huffmanCodes;
+    if (leaves.empty()) return huffmanCodes;
+
+    // Sizing the table to the range of values in the tree, values without a code get length 0
+    int minSymbol = leaves[0].first, maxSymbol = leaves[0].first;
+    for (const auto& leaf : leaves) {
+        minSymbol = min(minSymbol, leaf.first);
+        maxSymbol = max(maxSymbol, leaf.first);
+    }
+
+    huffmanCodes.minSymbol = minSymbol;
+    huffmanCodes.codes.assign((size_t)((int64_t)maxSymbol - minSymbol + 1), HuffmanCode{0, 0});
+    for (const auto& leaf : leaves) {
+        huffmanCodes.codes[(size_t)((int64_t)leaf.first - minSymbol)] = leaf.second;
+    }
 
     return huffmanCodes;
 }
 
 // generateHuffmanCodesRecursive()
-// Description: Generates Huffman codes for each value in a Huffman tree recursively
+// Description: Generates Huffman codes for each value in a Huffman tree recursively (left is 1,
+//              right is 0)
 // Input: const HuffmanNode* node - current node in the tree
-//        const string& code - current Huffman code
-//        map<int, string>& huffmanCodes - map of value to Huffman code
-// Output: No return value, modifies the huffmanCodes map
-void JpegImage::generateHuffmanCodesRecursive(const HuffmanNode* node, const string &code, map<int, string>& huffmanCodes) {
-    if (node == nullptr) return;
+//        uint64_t code, int length - Huffman code of the current node
+//        vector<pair<int, HuffmanCode>>& huffmanCodes - codes of the leaves visited so far
+// Output: bool - false if a leaf lies deeper than 63 bits (the walk stops there, so the recursion
+//         stays shallow whatever the shape of a tree rebuilt from an untrusted file)
+bool JpegImage::generateHuffmanCodesRecursive(const HuffmanNode* node, uint64_t code, int length, vector<pair<int, HuffmanCode>>& huffmanCodes) {
+    if (node == nullptr) return true;
+    if (length > 63) return false;
 
     if (node->left == nullptr && node->right == nullptr) {
-        huffmanCodes.insert(pair<int, string>(node->data, code));
+        huffmanCodes.push_back(pair<int, HuffmanCode>(node->data, HuffmanCode{code, length}));
     }
 
-    generateHuffmanCodesRecursive(node->left, code + '1', huffmanCodes);
-    generateHuffmanCodesRecursive(node->right, code + '0', huffmanCodes);
+    return generateHuffmanCodesRecursive(node->left, (code << 1) | 1, length + 1, huffmanCodes) &&
+           generateHuffmanCodesRecursive(node->right, code << 1, length + 1, huffmanCodes);
 }
 
 // encodeData()
-// Description: Encodes a sequence of integers using Huffman codes
+// Description: Encodes a sequence of integers using Huffman codes, packing the codes into bytes
 // Input: const vector<int>& data - sequence to encode
-//        const map<int, string>& huffmanCodes - map of value to Huffman code
-// Output: string - encoded data
-string JpegImage::encodeData(const vector<int>& data, const map<int, string>& huffmanCodes) {
-    string encodedData;
+//        const HuffmanCodeTable& huffmanCodes - table of value to Huffman code
+//        vector<unsigned char>& output - buffer the packed bits are appended to (the last byte is
+//                                        padded with zero bits)
+// Output: uint64_t - number of bits encoded
+uint64_t JpegImage::encodeData(const vector<int>& data, const HuffmanCodeTable& huffmanCodes, vector<unsigned char>& output) {
+    BitWriter writer(output);
 
     for (int i : data) {
-        encodedData += huffmanCodes.find(i)->second;
+        writer.writeCode(huffmanCodes[i]);
     }
 
-    return encodedData;
+    writer.flush();
+    return writer.bitCount();
 }
 
 // decodeData()
-// Description: Decodes a sequence of integers using Huffman codes
-// Input: const string& encodedData - encoded data
-//        const HuffmanNode* root - root of the Huffman tree
+// Description: Decodes a sequence of integers using Huffman codes, reading the packed bytes
+//              directly and resolving each code with the lookup tables
+// Input: const unsigned char* encodedData - packed encoded data
+//        uint64_t encodedBits - number of bits of encoded data
+//        const HuffmanDecodeTable& huffmanTable - lookup tables of the Huffman codes
+//        int rleSize - number of values stored in the file (used to size the output, up to one
+//                      value per bit)
 // Output: vector<int> - decoded data
-vector<int> JpegImage::decodeData(const string& encodedData, HuffmanNode* root) {
+vector<int> JpegImage::decodeData(const unsigned char* encodedData, uint64_t encodedBits, const HuffmanDecodeTable& huffmanTable, int rleSize) {
     // Variable declaration
     vector<int> decodedData;
-    HuffmanNode* current = root;
-    string currentCode;
+    decodedData.reserve((size_t)min<uint64_t>(max(rleSize, 0), encodedBits));
 
-    for (int i = 0; i < encodedData.size(); i++) {
-        if (encodedData[i] == '1') {
-            currentCode.append("1");
-            current = current->left;
-        } else {
-            currentCode.append("0");
-            current = current->right;
-        }
+    BitReader reader(encodedData, (encodedBits + 7) / 8, encodedBits);
+    int symbol;
 
-        if (current->left == nullptr && current->right == nullptr) {
-            decodedData.push_back(current->data);
-            current = root;
-        }
+    // Decoding until the data runs out (a trailing incomplete code is dropped)
+    while (decodeHuffmanSymbol(reader, huffmanTable, symbol)) {
+        decodedData.push_back(symbol);
     }
 
     return decodedData;
@@ -1407,84 +1793,45 @@ vector<int> JpegImage::decodeData(const string& encodedData, HuffmanNode* root)
 
 // writeEncodedDataToFile()
 // Description: Writes encoded data to a file
-// Input: const string& encodedData - encoded data
+// Input: const vector<unsigned char>& encodedData - packed encoded data
 //        const string& filePath - path to the output file
 // Output: No return value, writes the encoded data to the file
-void JpegImage::writeEncodedDataToFile(const string& encodedData, const string& filePath) {
+void JpegImage::writeEncodedDataToFile(const vector<unsigned char>& encodedData, const string& filePath) {
     ofstream outputFile(filePath, ios::binary);
     if (!outputFile.is_open()) {
         cerr << "Failed to open file for writing.\n";
         return;
     }
 
-    vector<unsigned char> buffer;
-    for (size_t i = 0; i < encodedData.size(); i += 8) {
-        // Take up to 8 bits from the encoded data
-        string byteString = encodedData.substr(i, 8);
-
-        // Make sure it's 8 bits long, padding with 0s if necessary
-        while (byteString.length() < 8) {
-            byteString += '0';
-        }
-
-        // Convert the 8-bit string to an actual byte
-        bitset<8> bits(byteString);
-        buffer.push_back(static_cast<unsigned char>(bits.to_ulong()));
-    }
-
-    // Write the buffer to file
-    outputFile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
-
+    outputFile.write(reinterpret_cast<const char*>(encodedData.data()), encodedData.size());
     outputFile.close();
 }
 
 // appendEncodedDataToFile()
 // Description: Appends encoded data to a file
-// Input: const string& encodedData - encoded data
+// Input: const vector<unsigned char>& encodedData - packed encoded data
 //        const string& filePath - path to the output file
 // Output: No return value, appends the encoded data to the file
-void JpegImage::appendEncodedDataToFile(const string& encodedData, const string& filePath) {
+void JpegImage::appendEncodedDataToFile(const vector<unsigned char>& encodedData, const string& filePath) {
     ofstream outputFile(filePath, ios::binary | ios::app);
     if (!outputFile.is_open()) {
         cerr << "Failed to open file for writing.\n";
         return;
     }
 
-    vector<unsigned char> buffer;
-    for (size_t i = 0; i < encodedData.size(); i += 8) {
-        // Take up to 8 bits from the encoded data
-        string byteString = encodedData.substr(i, 8);
-
-        // Make sure it's 8 bits long, padding with 0s if necessary
-        while (byteString.length() < 8) {
-            byteString += '0';
-        }
-
-        // Convert the 8-bit string to an actual byte
-
-        try {
-            bitset<8> bits(byteString);
-            buffer.push_back(static_cast<unsigned char>(bits.to_ulong()));
-        } catch (exception& e) {
-//            cout << "Exception - not valid byte string: " << byteString << endl;
-        }
-    }
-
-    // Write the buffer to file
-    outputFile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
-
+    outputFile.write(reinterpret_cast<const char*>(encodedData.data()), encodedData.size());
     outputFile.close();
 }
 
 // readEncodedDataFromFile()
 // Description: Reads encoded data from a file
 // Input: const string& filePath - path to the input file
-// Output: string - encoded data read from the file
-string JpegImage::readEncodedDataFromFile(const string& filePath, int starting_byte, int num_bytes) {
+// Output: vector<unsigned char> - packed encoded data read from the file
+vector<unsigned char> JpegImage::readEncodedDataFromFile(const string& filePath, int starting_byte, int num_bytes) {
     ifstream inputFile(filePath, ios::binary);
     if (!inputFile.is_open()) {
         cerr << "Failed to open file for reading.\n";
-        return "";
+        return {};
     }
 
     // Get the size of the file
@@ -1494,14 +1841,7 @@ string JpegImage::readEncodedDataFromFile(const string& filePath, int starting_b
     vector<unsigned char> buffer(num_bytes);
     inputFile.read(reinterpret_cast<char*>(buffer.data()), num_bytes);
 
-    // Convert the buffer to a string
-    string encodedData;
-    for (unsigned char byte : buffer) {
-        bitset<8> bits(byte);
-        encodedData.append(bits.to_string());
-    }
-
-    return encodedData;
+    return buffer;
 }
 
 // Steganography-related functions
@@ -1513,7 +1853,6 @@ void JpegImage::encodeLSBOnQuantizedBlocks(const string& message) {
     bool bit;
     unsigned int onMask = 0x01;
     unsigned int offMask = 0xFFFFFFFE;
-    DCTBlock* block;
     bool done = false;
 
     // Checking if image is large enough to hold the message
@@ -1523,54 +1862,48 @@ void JpegImage::encodeLSBOnQuantizedBlocks(const string& message) {
         return;
     }
 
-    // Looping over all quantized DCT blocks
-    for (int i = 0; i < height / 8 && !done; i++) {
-        for (int j = 0; j < width / 8 && !done; j++) {
-            block = quantizedBlocks[i][j];
-
-            // Looping over all channels of the block
-            for (int k = 0; k < 3; k++) {
-                int** channel = (k == 0) ? block->Y : (k == 1) ? block->Cb : block->Cr;
-
-                // Looping over all elements of the channel
-                for (int x = 0; x < 8 && !done; x++) {
-                    for (int y = 0; y < 8 && !done; y++) {
-                        if ((x != 0 || y != 0) && (channel[x][y] != 0) && (channel[x][y] != 1)) {
-                            // Check if the message has been fully encoded
-                            if (bitCount >= bitLength) {
-                                status = encoding_status::TERMINATOR;
-                            }
-
-                            // Get the next bit of the message
-                            switch (status) {
-                                case encoding_status::MESSAGE:
-                                    bit = getBit(message[bitCount / 8], 7 - bitCount % 8);
-                                    break;
-                                case encoding_status::TERMINATOR:
-                                    bit = false;
-                                    terminatorCount--;
-                                    if (terminatorCount == 0) {
-                                        done = true;
-                                    }
-                                    break;
-                                default:
-                                    break;
-                            }
+    // Looping over all quantized DCT blocks in MCU order (each block position's Y, Cb and Cr blocks
+    // in turn without subsampling)
+    forEachMcuBlock(quantizedPlanes(), 0, quantizedBlocks.mcuRows(), [&](int, coefficient *channel) {
+        // Looping over all elements of the channel
+        for (int x = 0; x < 8 && !done; x++) {
+            for (int y = 0; y < 8 && !done; y++) {
+                coefficient &value = channel[x * 8 + y];
+                if ((x != 0 || y != 0) && (value != 0) && (value != 1)) {
+                    // Check if the message has been fully encoded
+                    if (bitCount >= bitLength) {
+                        status = encoding_status::TERMINATOR;
+                    }
 
-                            // Encode the bit in the least significant bit of the channel element
-                            if (bit) {
-                                channel[x][y] |= onMask;
-                            } else {
-                                channel[x][y] &= offMask;
+                    // Get the next bit of the message
+                    switch (status) {
+                        case encoding_status::MESSAGE:
+                            bit = getBit(message[bitCount / 8], 7 - bitCount % 8);
+                            break;
+                        case encoding_status::TERMINATOR:
+                            bit = false;
+                            terminatorCount--;
+                            if (terminatorCount == 0) {
+                                done = true;
                             }
+                            break;
+                        default:
+                            break;
+                    }
 
-                            bitCount++;
-                        }
+                    // Encode the bit in the least significant bit of the channel element
+                    if (bit) {
+                        value |= onMask;
+                    } else {
+                        value &= offMask;
                     }
+
+                    bitCount++;
                 }
             }
         }
-    }
+        return !done;
+    });
 
     if (terminatorCount > 0) {
         cout << "Message too large to encode in this image." << endl;
@@ -1590,49 +1923,50 @@ string JpegImage::decodeLSBOnQuantizedBlocks() {
         return "";
     }
 
-    // Variable declaration
-    string message;
-    unsigned char character = 0;
-    DCTBlock *block;
-    unsigned int bitCount = 0;
-    bool bit;
-    bool done = false;
+    // Reading the blocks in the order they were embedded in
+    LsbMessageReader reader;
+    forEachMcuBlock(quantizedPlanes(), 0, quantizedBlocks.mcuRows(), [&](int, const coefficient *block) {
+        return reader.readBlock(block);
+    });
 
-    // Looping over quantized blocks
-    for (int i = 0; i < height / 8 && !done; i++) {
-        for (int j = 0; j < width / 8 && !done; j++) {
-            block = quantizedBlocks[i][j];
-
-            for (int k = 0; k < 3; k++) {
-                int **channel = (k == 0) ? block->Y : (k == 1) ? block->Cb : block->Cr;
-
-                for (int x = 0; x < 8 && !done; x++) {
-                    for (int y = 0; y < 8 && !done; y++) {
-                        if ((x != 0 || y != 0) && (channel[x][y] != 0) && (channel[x][y] != 1)) {
-                            // Getting LSB of the DCT coefficient
-                            bit = channel[x][y] & 0x01;
-
-                            // Shifting character bits left and adding current bit
-                            character = (character << 1) | bit;
-
-                            bitCount++;
-
-                            // Checking end of character
-                            if (bitCount % 8 == 0) {
-                                // Checking for null terminator
-                                if (character == 0) {
-                                    done = true;
-                                } else {
-                                    message += (char)character;
-                                    character = 0;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    return reader.message();
+}
+
+// extractLSBMessage()
+// Description: Extracts a message encoded using LSB on quantized DCT blocks straight from a (custom)
+//              jpg file, reading it in place through a memory map
+// Input: string inputFilename - path to the input jpg file
+// Output: string - decoded message
+string JpegImage::extractLSBMessage(const std::string& inputFilename) {
+    MappedFile file;
+    if (!file.open(inputFilename)) {
+        cout << "Failed to open " << inputFilename << " - JpegImage::extractLSBMessage" << endl;
+        return "";
     }
 
-    return message;
+    return extractLSBMessageFromMemory(file.data(), file.size());
+}
+
+// extractLSBMessageFromMemory()
+// Description: Extracts a message encoded using LSB on quantized DCT blocks from the bytes of a
+//              (custom) jpg file. Blocks are entropy-decoded one at a time and handed to the message
+//              reader, and decoding stops at the terminator - the image is never decoded as a whole
+// Input: const unsigned char* data, size_t size - contents of the jpg file
+// Output: string - decoded message
+string JpegImage::extractLSBMessageFromMemory(const unsigned char* data, size_t size) {
+    JpegContainerHeader header;
+    size_t payloadOffset;
+    if (!parseContainerHeader(data, size, header, payloadOffset)) {
+        cout << "Invalid or truncated file - JpegImage::extractLSBMessage" << endl;
+        return "";
+    }
+
+    LsbMessageReader reader;
+    auto visit = [&reader](int, int, int, const coefficient *block) { return reader.readBlock(block); };
+
+    const unsigned char* payload = data + payloadOffset;
+    const bool valid = header.version == JPEG_FORMAT_RUN_SIZE ? streamRunSizeBlocks(header, payload, 0, visit)
+                                                               : streamRleBlocks(header, payload, visit);
+
+    return valid ? reader.message() : "";
 }
\ No newline at end of file
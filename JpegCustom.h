@@ -4,6 +4,12 @@
 #include <string>
 #include "CImg.h"
 #include "StegoLib.h"
+#include "PngCodec.h"
+#include "JpegDct.h"
+#include "JpegHuffman.h"
+#include "JpegContainer.h"
+#include "JpegEntropy.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <cmath>
 #include <iostream>
@@ -11,6 +17,7 @@
 #include <fstream>
 #include <bitset>
 #include <chrono>
+#include <cstdint>
 
 #define INPUT_JPEG_SIZE (4 * 4 * 8 * 8 * 3)
 #define PROCESSED_JPEG_INPUT (16)
@@ -26,12 +33,56 @@ typedef struct quantizationTables {
     int chrominance[8][8];
 } quantizationTable;
 
+// DCTBlock
+// Lightweight view of one 8x8 block of a CoefficientStore. Each channel points at 64 contiguous
+// coefficients in row-major order, so element (x, y) of the Y channel is Y[x * 8 + y]
 typedef struct DCTBlock {
-    int **Y;
-    int **Cb;
-    int **Cr;
+    coefficient *Y;
+    coefficient *Cb;
+    coefficient *Cr;
+
+    coefficient* channel(int k) const { return (k == 0) ? Y : (k == 1) ? Cb : Cr; }
 } DCTBlock;
 
+// LsbMessageReader
+// Collects a message hidden in the LSBs of quantized blocks, fed one block at a time in embedding
+// order. Every non-DC coefficient other than 0 and 1 carries a bit, most significant bit of each
+// character first, and a null character ends the message
+class LsbMessageReader {
+public:
+    // readBlock()
+    // Description: Reads the bits of one block (64 coefficients in row-major order)
+    // Output: bool - false once the terminator has been read
+    bool readBlock(const coefficient *block) {
+        for (int i = 1; i < 64; i++) {
+            const coefficient value = block[i];
+            if (value == 0 || value == 1) {
+                continue;
+            }
+
+            character = (unsigned char)((character << 1) | (value & 0x01));
+            if (++bitCount % 8 == 0) {
+                if (character == 0) {
+                    done = true;
+                    return false;
+                }
+                text += (char)character;
+                character = 0;
+            }
+        }
+        return true;
+    }
+
+    bool finished() const { return done; }
+    const string& message() const { return text; }
+
+private:
+    string text;
+    unsigned char character = 0;
+    unsigned int bitCount = 0;
+    bool done = false;
+};
+
 typedef struct RunLengthPair {
     int run;
     int value;
@@ -77,6 +128,83 @@ enum Channel {
     Cr
 };
 
+// Resolution of the chroma channels relative to luma
+enum class ChromaSubsampling {
+    Chroma444, // full resolution, 8x8 MCUs
+    Chroma422, // half the width, 16x8 MCUs
+    Chroma420  // half the width and height, 16x16 MCUs
+};
+
+// Last stage decodeJpeg() runs
+enum class DecodeUntil {
+    Coefficients,    // quantized coefficients (all message extraction needs)
+    DctCoefficients, // dequantized DCT coefficients
+    Pixels           // YCbCr and RGB pixels
+};
+
+// CoefficientStore
+// Coefficients of every 8x8 block, held as one contiguous, aligned plane per channel. Blocks are
+// stored block-major in raster order with 64 coefficients each, so block (row, col) of a channel
+// starts at (row * planeCols(k) + col) * 64 - no per-block allocations and no pointer chasing.
+// With subsampled chroma an MCU covers hSampling x vSampling luma blocks and one block of each
+// chroma plane, so the chroma planes hold ceil(rows / vSampling) x ceil(cols / hSampling) blocks
+class CoefficientStore {
+public:
+    // Allocates (or reuses) zeroed planes for rows x cols luma blocks and their chroma blocks
+    void allocate(int rows, int cols, int hSampling = 1, int vSampling = 1) {
+        blockRows = rows;
+        blockCols = cols;
+        horizontalSampling = hSampling;
+        verticalSampling = vSampling;
+        for (int k = 0; k < 3; k++) {
+            planes[k].allocate((size_t)planeRows(k) * planeCols(k) * 64);
+        }
+    }
+
+    void release() {
+        blockRows = 0;
+        blockCols = 0;
+        horizontalSampling = 1;
+        verticalSampling = 1;
+        for (auto &plane : planes) {
+            plane.release();
+        }
+    }
+
+    // Luma blocks
+    int rows() const { return blockRows; }
+    int cols() const { return blockCols; }
+    size_t blockCount() const { return (size_t)blockRows * blockCols; }
+
+    // Blocks of each channel and the MCU layout
+    int planeRows(int k) const { return k == Y ? blockRows : (blockRows + verticalSampling - 1) / verticalSampling; }
+    int planeCols(int k) const { return k == Y ? blockCols : (blockCols + horizontalSampling - 1) / horizontalSampling; }
+    int hSampling() const { return horizontalSampling; }
+    int vSampling() const { return verticalSampling; }
+    int mcuRows() const { return planeRows(Cb); }
+    bool subsampled() const { return horizontalSampling != 1 || verticalSampling != 1; }
+
+    coefficient* plane(int k) { return planes[k].data(); }
+    const coefficient* plane(int k) const { return planes[k].data(); }
+
+    coefficient* channel(int k, int row, int col) {
+        return planes[k].data() + ((size_t)row * planeCols(k) + col) * 64;
+    }
+
+    // Luma block at one position and the chroma blocks covering it
+    DCTBlock block(int row, int col) {
+        return { channel(Y, row, col), channel(Cb, row / verticalSampling, col / horizontalSampling),
+                 channel(Cr, row / verticalSampling, col / horizontalSampling) };
+    }
+
+private:
+    int blockRows = 0;
+    int blockCols = 0;
+    int horizontalSampling = 1;
+    int verticalSampling = 1;
+    AlignedBuffer<coefficient> planes[3];
+};
+
 class JpegImage
 {
 public:
@@ -109,6 +237,22 @@ public:
         // Initialize AAN constants
         initAAN();
 
+        // Pick the fastest DCT kernel the CPU supports
+        dctKernel = detectDctKernel();
+        dctMode = DctMode::Float;
+
+        // Run every stage on the calling thread until told otherwise
+        threadCount = 1;
+
+        // Write canonical Huffman containers
+        formatVersion = JPEG_FORMAT_CANONICAL;
+
+        // One payload without restart segments
+        restartInterval = 0;
+
+        // Full resolution chroma
+        chromaSubsampling = ChromaSubsampling::Chroma444;
+
         // Initialize luminance and chrominance tables
         setQuantizationTables(quality);
     }
@@ -143,18 +287,59 @@ public:
         setQuantizationTables(q);
     }
 
+    // Selects the DCT kernel, falling back to the scalar kernel if the CPU does not support it
+    void setDctKernel(DctKernel kernel) {
+        dctKernel = dctKernelSupported(kernel) ? kernel : DctKernel::Scalar;
+    }
+
+    DctKernel getDctKernel() const { return dctKernel; }
+
+    // Selects float or 13-bit fixed-point integer arithmetic for the DCT and inverse DCT
+    void setDctMode(DctMode mode) { dctMode = mode; }
+
+    DctMode getDctMode() const { return dctMode; }
+
+    // Number of threads the per-block stages split their block rows across (0 uses every hardware
+    // thread). The output does not depend on it
+    void setThreadCount(int threads) {
+        threadCount = threads > 0 ? threads : ThreadPool::shared().concurrency();
+    }
+
+    int getThreadCount() const { return threadCount; }
+
+    // Container version encodeJpeg() writes (JPEG_FORMAT_LEGACY, JPEG_FORMAT_CANONICAL or
+    // JPEG_FORMAT_RUN_SIZE), decodeJpeg() reads every version
+    void setFormatVersion(int version) {
+        formatVersion = (version >= JPEG_FORMAT_LEGACY && version <= JPEG_FORMAT_RUN_SIZE) ? version : JPEG_FORMAT_CANONICAL;
+    }
+
+    int getFormatVersion() const { return formatVersion; }
+
+    // Splits the version 3 payload into byte-aligned restart segments of the given number of MCU
+    // rows, each coded on its own so segments are encoded and decoded in parallel (0 writes one
+    // payload). Ignored by the other container versions
+    void setRestartInterval(int mcuRows) { restartInterval = mcuRows > 0 ? mcuRows : 0; }
+
+    int getRestartInterval() const { return restartInterval; }
+
+    // Chroma resolution of the encoded image. Subsampled chroma needs container version 3; it
+    // roughly halves the DCT, quantization and entropy coding work. decodeJpeg() sets it from the file
+    void setChromaSubsampling(ChromaSubsampling subsampling) { chromaSubsampling = subsampling; }
+
+    ChromaSubsampling getChromaSubsampling() const { return chromaSubsampling; }
+
     // Attributes
     int width{};
     int height;
     bool successfullyEncoded = false;
 
     // Pixel data
-    vector<vector<color>> pixelsRGB;
-    vector<vector<ycbcr>> pixelsYCbCr;
+    PixelBuffer<color> pixelsRGB;
+    PixelBuffer<ycbcr> pixelsYCbCr;
 
     // DCT Values
-    vector<vector<DCTBlock*>> dctBlocks; // 8x8 grid with DCT coefficients
-    vector<vector<DCTBlock*>> quantizedBlocks; // 8x8 grid with quantized DCT coefficients
+    CoefficientStore dctBlocks; // 8x8 grid with DCT coefficients
+    CoefficientStore quantizedBlocks; // 8x8 grid with quantized DCT coefficients
 
     // Precomputed values
     const static int M = 8, N = 8;
@@ -163,6 +348,7 @@ public:
     double alpha[N], cosines[N * N];
 
     quantizationTables quantTables;
+    QuantTable channelQuantTables[2]; // Luminance and chrominance tables with precomputed reciprocals
 
     bool rgbLoaded = false;
     bool ycbcrLoaded = false;
@@ -181,18 +367,26 @@ public:
     // Encoding and decoding main functions
     void encodeJpeg(const std::string& outputFilename);
     void encodeJpeg(const std::string& outputFilename, const bool useStego, const std::string& message);
+    vector<unsigned char> encodeJpegToMemory(const bool useStego, const std::string& message); // returns the jpg file's bytes
     void encodeJpeg(const string& outputFilename, const string& message);
-    void decodeJpeg(const std::string& outputFilename);
+    void decodeJpeg(const std::string& outputFilename, DecodeUntil until = DecodeUntil::Pixels);
+    void decodeJpegFromMemory(const unsigned char* data, size_t size, DecodeUntil until = DecodeUntil::Pixels); // decodes the bytes of a jpg file in place
+    void decodeJpegScaled(const std::string& inputFilename, int scale); // decodes at 1/scale size (scale 1, 2, 4 or 8) for previews
+    void decodeJpegScaledFromMemory(const unsigned char* data, size_t size, int scale);
+    void decodeJpegRegion(const std::string& inputFilename, int x, int y, int w, int h); // decodes the (x, y, w, h) crop only
+    void decodeJpegRegionFromMemory(const unsigned char* data, size_t size, int x, int y, int w, int h);
 
 
     // File operations
-    string readEncodedDataFromFile(const string& filePath, int starting_byte, int num_bytes);
-    void writeEncodedDataToFile(const string& encodedData, const string& filePath);
-    void appendEncodedDataToFile(const string& encodedData, const string& filePath);
+    vector<unsigned char> readEncodedDataFromFile(const string& filePath, int starting_byte, int num_bytes);
+    void writeEncodedDataToFile(const vector<unsigned char>& encodedData, const string& filePath);
+    void appendEncodedDataToFile(const vector<unsigned char>& encodedData, const string& filePath);
 
     // Basic methods
     void loadPng(string filename);
+    void loadPngFromMemory(const unsigned char* data, size_t size);
     void savePng(string filename);
+    vector<unsigned char> savePngToMemory(); // returns the png file's bytes
     void rgbToYCbCr();
     void yCbCrToRGB();
 
@@ -200,6 +394,7 @@ public:
     void generateDCTBlocks();
     void invertDCTBlocks(); // Converts DCT blocks to pixel data (YCbCr)
     void generateQuantizedBlocks();
+    void generateQuantizedDCTBlocks(); // DCT with quantization fused in, pixel data straight to quantized blocks
     void dequantizeBlocks(); // Converts quantized DCT blocks to DCT blocks
 
     // RLE Functions
@@ -209,52 +404,91 @@ public:
 
     // Zigzag scanning
     void zigzag(vector<int> &sequence); // returns zigzagged vector of quantized DCT coefficients
-    void zigzagBlock(int **block, vector<int> &sequence); // zigzagging of a vector of ints
-    void zigzagDCTBlock(DCTBlock *block, vector<int> &sequence); // zigzagging of a DCT block
+    void zigzagBlock(const coefficient *block, vector<int> &sequence); // zigzagging of a vector of ints
+    void zigzagDCTBlock(const DCTBlock &block, vector<int> &sequence); // zigzagging of a DCT block
     void inverseZigzag(vector<int> &sequence); // inverse zigzagging of a vector of ints
-    void inverseZigzagBlock(vector<int> &sequence, int **block, int start_index);
-    void inverseZigzagDCTBlock(vector<int> &sequence, DCTBlock *block, int start_index);
+    void inverseZigzagBlock(vector<int> &sequence, coefficient *block, int start_index);
+    void inverseZigzagDCTBlock(vector<int> &sequence, const DCTBlock &block, int start_index);
 
     // Huffman encoding
     // 1. Given vector of ints (after RLE encoding), calculate frequencies
     // 2. Build Huffman tree
     // 3. Generate Huffman codes
-    // 4. Encode data into string of codes
+    // 4. Encode data into packed bits
 
     static map<int, int> calculateFrequencies(const vector<int>& data);
     HuffmanNode* buildHuffmanTree(const map<int, int>& frequencies);
-    map<int, string> generateHuffmanCodes(const HuffmanNode* node);
-    void generateHuffmanCodesRecursive(const HuffmanNode* node, const string& code, map<int, string>& huffmanCodes);
-    string encodeData(const vector<int>& data, const map<int, string>& huffmanCodes);
-    vector<int> decodeData(const string& encodedData, HuffmanNode* huffmanTree);
+    HuffmanCodeTable generateHuffmanCodes(const HuffmanNode* node);
+    bool generateHuffmanCodesRecursive(const HuffmanNode* node, uint64_t code, int length, vector<pair<int, HuffmanCode>>& huffmanCodes);
+    uint64_t encodeData(const vector<int>& data, const HuffmanCodeTable& huffmanCodes, vector<unsigned char>& output);
+    vector<int> decodeData(const unsigned char* encodedData, uint64_t encodedBits, const HuffmanDecodeTable& huffmanTable, int rleSize);
 
     // Block operations
     // DCT II Operations - blocks are always 8x8
     void setQuantizationTables(int quality = 50);
-    void dct2OnBlock(int **block, int **result);
-    void idct2OnBlock(int **block, int **result);
-    void dct2OnAllBlockChannels(DCTBlock *input, DCTBlock *output);
-    void idct2OnAllBlockChannels(DCTBlock *input, DCTBlock *output);
-
-    // Memory operations
-    static DCTBlock* allocateDCTBlock();
-    static int** allocateMatrix(int rows, int cols);
-    static void deallocateMatrix(int** matrix, int rows);
-    static void deallocateDCTBlock(DCTBlock* block);
+    void dct2OnBlock(const coefficient *block, coefficient *result);
+    void idct2OnBlock(const coefficient *block, coefficient *result);
+    void dct2OnAllBlockChannels(const DCTBlock &input, const DCTBlock &output);
+    void idct2OnAllBlockChannels(const DCTBlock &input, const DCTBlock &output);
 
     // Quantization and Dequantization
-    void quantizeBlock(int **block, Channel channel);
-    void dequantizeBlock(int **block, Channel channel);
-    void quantizeBlockChannels(DCTBlock *block);
-    void dequantizeBlockChannels(DCTBlock *block);
+    void quantizeBlock(coefficient *block, Channel channel);
+    void dequantizeBlock(coefficient *block, Channel channel);
+    void quantizeBlockChannels(const DCTBlock &block);
+    void dequantizeBlockChannels(const DCTBlock &block);
+    const QuantTable& channelQuantTable(int channel) const { return channelQuantTables[channel == Y ? 0 : 1]; }
 
     // Steganography operations
     void encodeLSBOnQuantizedBlocks(const string& message);
     string decodeLSBOnQuantizedBlocks();
 
+    // Message extraction straight from a jpg file: blocks are entropy-decoded one at a time and
+    // decoding stops at the message's terminator, so short messages cost a few blocks
+    string extractLSBMessage(const std::string& inputFilename);
+    string extractLSBMessageFromMemory(const unsigned char* data, size_t size);
+
     // View image
     void displayImage();
 
 private:
+    bool encodeContainer(const bool useStego, const std::string& message, vector<unsigned char>& output);
+    void encodeRleEntropy(JpegContainerHeader& header, vector<unsigned char>& output);
+    void encodeRunSizeEntropy(JpegContainerHeader& header, vector<unsigned char>& output);
+    bool decodeCoefficients(const unsigned char* data, size_t size); // header and entropy decoding into quantizedBlocks
+    bool readContainerHeader(const unsigned char* data, size_t size, JpegContainerHeader& header, size_t& payloadOffset);
+    void cropLoadedPixels();
+    bool decodeRleEntropy(const JpegContainerHeader& header, const unsigned char* payload);
+    bool decodeRunSizeEntropy(const JpegContainerHeader& header, const unsigned char* payload);
+    bool buildRleDecodeTable(const JpegContainerHeader& header, HuffmanDecodeTable& table);
+    bool buildRunSizeDecodeTables(const JpegContainerHeader& header, RunSizeDecodeTables& tables, int tableSlot[3]);
+
+    // Entropy-decode the blocks of a container one at a time in coding order, handing each to
+    // visit(channel, row, col, block) until it returns false. Return false if the data is invalid
+    bool streamRleBlocks(const JpegContainerHeader& header, const unsigned char* payload, const function<bool(int, int, int, const coefficient*)>& visit);
+    bool streamRunSizeBlocks(const JpegContainerHeader& header, const unsigned char* payload, int mcuRowBegin,
+                             const function<bool(int, int, int, const coefficient*)>& visit);
+
+    // Luma blocks per MCU of the chroma subsampling mode
+    int hSamplingFactor() const { return chromaSubsampling == ChromaSubsampling::Chroma444 ? 1 : 2; }
+    int vSamplingFactor() const { return chromaSubsampling == ChromaSubsampling::Chroma420 ? 2 : 1; }
+
+    // Coefficient planes of the quantized blocks, as the entropy coder walks them
+    BlockPlanes quantizedPlanes() {
+        return { { quantizedBlocks.plane(Y), quantizedBlocks.plane(Cb), quantizedBlocks.plane(Cr) }, quantizedBlocks.rows(), quantizedBlocks.cols(),
+                 quantizedBlocks.hSampling(), quantizedBlocks.vSampling() };
+    }
+    void transformPixelBlocks(CoefficientStore &output, bool quantize);
+
+    // Runs body over [0, rows) split into contiguous row ranges on the shared thread pool
+    void forEachRow(int rows, const function<void(int, int)> &body) {
+        ThreadPool::shared().parallelFor(0, rows, threadCount, body);
+    }
+
     int quality;
+    DctKernel dctKernel;
+    DctMode dctMode;
+    int threadCount;
+    int formatVersion;
+    int restartInterval;
+    ChromaSubsampling chromaSubsampling;
 };
\ No newline at end of file
@@ -0,0 +1,505 @@
+#include <cmath>
+#include "JpegDct.h"
+#include "JpegDctKernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define JPEG_DCT_SSE2 1
+#    include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#    include <intrin.h>
+#endif
+
+// Scalar lane conversions
+static inline coefficient toCoefficient(float x) {
+    return std::round(x + 0.5f); // Round to nearest int
+}
+
+static inline coefficient toCoefficient(int32_t x) {
+    return x;
+}
+
+// quantizeValue()
+// Description: Truncating division of a coefficient by its quantization step, as a multiply-shift
+static inline coefficient quantizeValue(coefficient c, uint32_t reciprocal, uint32_t shift) {
+    const uint32_t magnitude = c < 0 ? 0u - (uint32_t)c : (uint32_t)c;
+    const coefficient quotient = (coefficient)((magnitude * reciprocal) >> shift);
+    return c < 0 ? -quotient : quotient;
+}
+
+// Scalar kernel
+// forwardDctBlocksScalar()
+// Description: Reference forward DCT, one 8x8 block at a time (L is float or int32_t)
+template <typename L>
+static void forwardDctBlocksScalar(const coefficient *samples, coefficient *output, int count, const QuantTable *quant) {
+    for (int b = 0; b < count; b++, samples += 64, output += 64) {
+        L lanes[8];
+
+        // Vertical pass, one column at a time
+        L component[64];
+        for (int i = 0; i < 8; i++) {
+            for (int k = 0; k < 8; k++) lanes[k] = static_cast<L>(samples[k * 8 + i]);
+            forwardPass<true>(lanes);
+            for (int k = 0; k < 8; k++) component[k * 8 + i] = lanes[k];
+        }
+
+        // Horizontal pass, one row at a time
+        for (int i = 0; i < 8; i++) {
+            for (int k = 0; k < 8; k++) lanes[k] = component[i * 8 + k];
+            forwardPass<false>(lanes);
+            for (int k = 0; k < 8; k++) component[i * 8 + k] = lanes[k];
+        }
+
+        if (quant) {
+            for (int i = 0; i < 64; ++i) {
+                output[i] = quantizeValue(toCoefficient(component[i]), quant->reciprocal[i], quant->shift[i]);
+            }
+        } else {
+            for (int i = 0; i < 64; ++i) {
+                output[i] = toCoefficient(component[i]);
+            }
+        }
+    }
+}
+
+// inverseDctBlockScalar()
+// Description: Reference inverse DCT of one block; sparse blocks skip the zero columns and rows
+template <typename L>
+static void inverseDctBlockScalar(const coefficient *coefficients, coefficient *output, IdctClass cls) {
+    const bool sparse = cls == IdctClass::Sparse4x4;
+    const int columns = sparse ? 4 : 8;
+    L lanes[8];
+
+    // Vertical pass, one column at a time (columns 4-7 of a sparse block stay zero)
+    L component[64] = {};
+    for (int i = 0; i < columns; i++) {
+        for (int k = 0; k < 8; k++) lanes[k] = static_cast<L>(coefficients[k * 8 + i]);
+        if (sparse) inversePassSparse<true>(lanes);
+        else inversePass<true>(lanes);
+        for (int k = 0; k < 8; k++) component[k * 8 + i] = lanes[k];
+    }
+
+    // Horizontal pass, one row at a time
+    for (int i = 0; i < 8; i++) {
+        for (int k = 0; k < 8; k++) lanes[k] = component[i * 8 + k];
+        if (sparse) inversePassSparse<false>(lanes);
+        else inversePass<false>(lanes);
+        for (int k = 0; k < 8; k++) component[i * 8 + k] = lanes[k];
+    }
+
+    for (int i = 0; i < 64; ++i) {
+        output[i] = toCoefficient(component[i]);
+    }
+}
+
+#ifdef JPEG_DCT_SSE2
+namespace {
+
+// Four float lanes with the operators the butterflies need
+struct F4 {
+    __m128 v;
+    F4() = default;
+    F4(__m128 x) : v(x) {}
+    F4(float f) : v(_mm_set1_ps(f)) {}
+};
+
+inline F4 operator+(F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+inline F4 operator-(F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+inline F4 operator*(F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+inline F4 operator-(F4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+
+// Four int32 lanes with the operators the integer butterflies need
+struct I4 {
+    __m128i v;
+    I4() = default;
+    I4(__m128i x) : v(x) {}
+    I4(int32_t i) : v(_mm_set1_epi32(i)) {}
+};
+
+inline I4 operator+(I4 a, I4 b) { return _mm_add_epi32(a.v, b.v); }
+inline I4 operator-(I4 a, I4 b) { return _mm_sub_epi32(a.v, b.v); }
+
+// SSE2 has no 32-bit low multiply, so the even and odd lanes go through _mm_mul_epu32
+// (the low 32 bits of the product are the same for signed and unsigned operands)
+inline I4 operator*(I4 a, I4 b) {
+    const __m128i even = _mm_mul_epu32(a.v, b.v);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a.v, 4), _mm_srli_si128(b.v, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+template <int n>
+inline I4 shiftLeft(I4 x) {
+    return _mm_slli_epi32(x.v, n);
+}
+
+template <int n>
+inline I4 descale(I4 x) {
+    return _mm_srai_epi32(_mm_add_epi32(x.v, _mm_set1_epi32(1 << (n - 1))), n);
+}
+
+template <bool FirstPass> inline void forwardPass(F4 x[8]) { fdctPass(x); }
+template <bool FirstPass> inline void forwardPass(I4 x[8]) { fdctPassInt<I4, FirstPass>(x); }
+template <bool FirstPass> inline void inversePass(F4 x[8]) { idctPass(x); }
+template <bool FirstPass> inline void inversePass(I4 x[8]) { idctPassInt<I4, FirstPass>(x); }
+template <bool FirstPass> inline void inversePassSparse(F4 x[8]) { idctPassSparse(x); }
+template <bool FirstPass> inline void inversePassSparse(I4 x[8]) { idctPassIntSparse<I4, FirstPass>(x); }
+
+inline void load(F4 &x, const coefficient *p) {
+    x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)p));
+}
+
+inline void load(I4 &x, const coefficient *p) {
+    x = _mm_loadu_si128((const __m128i*)p);
+}
+
+// Matches std::round(x + 0.5f) of the scalar kernel (round half away from zero) using SSE2 only
+inline __m128i roundToCoefficients(__m128 x) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 y = _mm_add_ps(x, _mm_set1_ps(0.5f));
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+    const __m128 fraction = _mm_andnot_ps(signMask, _mm_sub_ps(y, truncated));
+    const __m128 step = _mm_or_ps(_mm_and_ps(y, signMask), _mm_set1_ps(1.0f));
+    const __m128 rounded = _mm_add_ps(truncated, _mm_and_ps(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f)), step));
+    return _mm_cvttps_epi32(rounded);
+}
+
+inline void store(coefficient *p, F4 x) {
+    _mm_storeu_si128((__m128i*)p, roundToCoefficients(x.v));
+}
+
+inline void store(coefficient *p, I4 x) {
+    _mm_storeu_si128((__m128i*)p, x.v);
+}
+
+// Transposes a 4x4 quadrant held in x[0..3] into y[0..3]
+inline void transpose4(const F4 *x, F4 *y) {
+    __m128 r0 = x[0].v, r1 = x[1].v, r2 = x[2].v, r3 = x[3].v;
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    y[0] = r0;
+    y[1] = r1;
+    y[2] = r2;
+    y[3] = r3;
+}
+
+inline void transpose4(const I4 *x, I4 *y) {
+    __m128 r0 = _mm_castsi128_ps(x[0].v), r1 = _mm_castsi128_ps(x[1].v);
+    __m128 r2 = _mm_castsi128_ps(x[2].v), r3 = _mm_castsi128_ps(x[3].v);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    y[0] = _mm_castps_si128(r0);
+    y[1] = _mm_castps_si128(r1);
+    y[2] = _mm_castps_si128(r2);
+    y[3] = _mm_castps_si128(r3);
+}
+
+// Transposes an 8x8 block held as left (columns 0-3) and right (columns 4-7) halves of each row.
+// Each 4x4 quadrant is transposed and the two off-diagonal quadrants swap places.
+template <typename L>
+inline void transpose8(L *left, L *right) {
+    L newLeft[8], newRight[8];
+    transpose4(left, newLeft);
+    transpose4(right, newLeft + 4);
+    transpose4(left + 4, newRight);
+    transpose4(right + 4, newRight + 4);
+    for (int k = 0; k < 8; k++) {
+        left[k] = newLeft[k];
+        right[k] = newRight[k];
+    }
+}
+
+}
+
+// SSE2 kernel
+// forwardDctBlocksSse2()
+// Description: Forward DCT with each row split into two 4-lane halves (L is F4 or I4)
+template <typename L>
+static void forwardDctBlocksSse2(const coefficient *samples, coefficient *output, int count, const QuantTable *quant) {
+    for (int b = 0; b < count; b++, samples += 64, output += 64) {
+        L left[8], right[8];
+        for (int k = 0; k < 8; k++) {
+            load(left[k], samples + k * 8);
+            load(right[k], samples + k * 8 + 4);
+        }
+
+        // Vertical pass on the rows, horizontal pass on the transposed block
+        forwardPass<true>(left);
+        forwardPass<true>(right);
+        transpose8(left, right);
+        forwardPass<false>(left);
+        forwardPass<false>(right);
+        transpose8(left, right);
+
+        for (int k = 0; k < 8; k++) {
+            store(output + k * 8, left[k]);
+            store(output + k * 8 + 4, right[k]);
+        }
+
+        // SSE2 has no per-lane shifts, so the quantization runs on the stored block
+        if (quant) {
+            for (int i = 0; i < 64; ++i) {
+                output[i] = quantizeValue(output[i], quant->reciprocal[i], quant->shift[i]);
+            }
+        }
+    }
+}
+
+// inverseDctBlockSse2()
+// Description: Inverse DCT of one block with each row split into two 4-lane halves
+template <typename L>
+static void inverseDctBlockSse2(const coefficient *coefficients, coefficient *output, IdctClass cls) {
+    L left[8], right[8];
+
+    if (cls == IdctClass::Sparse4x4) {
+        // Only rows 0-3 of columns 0-3 hold coefficients: one vertical pass on the left half, whose
+        // transpose fills rows 0-3 of both halves, then a sparse horizontal pass
+        for (int k = 0; k < 4; k++) {
+            load(left[k], coefficients + k * 8);
+        }
+        inversePassSparse<true>(left);
+        transpose4(left + 4, right);
+        transpose4(left, left);
+        inversePassSparse<false>(left);
+        inversePassSparse<false>(right);
+    } else {
+        for (int k = 0; k < 8; k++) {
+            load(left[k], coefficients + k * 8);
+            load(right[k], coefficients + k * 8 + 4);
+        }
+        inversePass<true>(left);
+        inversePass<true>(right);
+        transpose8(left, right);
+        inversePass<false>(left);
+        inversePass<false>(right);
+    }
+    transpose8(left, right);
+
+    for (int k = 0; k < 8; k++) {
+        store(output + k * 8, left[k]);
+        store(output + k * 8 + 4, right[k]);
+    }
+}
+#endif
+
+// cpuSupportsAvx2()
+// Description: Checks that both the CPU and the OS (saved YMM state) support AVX2
+static bool cpuSupportsAvx2() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+// dctKernelSupported()
+// Description: Checks whether a kernel was compiled in and can run on this CPU
+bool dctKernelSupported(DctKernel kernel) {
+    switch (kernel) {
+        case DctKernel::Scalar:
+            return true;
+        case DctKernel::SSE2:
+#ifdef JPEG_DCT_SSE2
+            return true;
+#else
+            return false;
+#endif
+        case DctKernel::AVX2: {
+            static const bool supported = avx2DctCompiled() && cpuSupportsAvx2();
+            return supported;
+        }
+    }
+    return false;
+}
+
+// detectDctKernel()
+// Description: Returns the fastest kernel supported by this build and CPU
+DctKernel detectDctKernel() {
+    if (dctKernelSupported(DctKernel::AVX2)) return DctKernel::AVX2;
+    if (dctKernelSupported(DctKernel::SSE2)) return DctKernel::SSE2;
+    return DctKernel::Scalar;
+}
+
+const char* dctKernelName(DctKernel kernel) {
+    switch (kernel) {
+        case DctKernel::Scalar: return "scalar";
+        case DctKernel::SSE2: return "SSE2";
+        case DctKernel::AVX2: return "AVX2";
+    }
+    return "unknown";
+}
+
+void forwardDctBlocks(const coefficient *samples, coefficient *output, int count, DctKernel kernel, DctMode mode,
+                      const QuantTable *quant) {
+    const bool integer = mode == DctMode::Integer;
+
+    switch (kernel) {
+        case DctKernel::AVX2:
+            forwardDctBlocksAvx2(samples, output, count, mode, quant);
+            return;
+#ifdef JPEG_DCT_SSE2
+        case DctKernel::SSE2:
+            if (integer) forwardDctBlocksSse2<I4>(samples, output, count, quant);
+            else forwardDctBlocksSse2<F4>(samples, output, count, quant);
+            return;
+#endif
+        default:
+            if (integer) forwardDctBlocksScalar<int32_t>(samples, output, count, quant);
+            else forwardDctBlocksScalar<float>(samples, output, count, quant);
+            return;
+    }
+}
+
+void buildQuantTable(const int steps[8][8], QuantTable &table) {
+    for (int i = 0; i < 64; i++) {
+        const uint32_t q = steps[i / 8][i % 8];
+
+        // With l = ceil(log2(q)) and shift = 15 + l, the reciprocal ceil(2^shift / q) is at most
+        // 2^16, so |c| * reciprocal fits in 32 bits and the quotient is exact for |c| < 2^15
+        uint32_t l = 0;
+        while ((1u << l) < q) l++;
+
+        table.divisor[i] = q;
+        table.shift[i] = 15 + l;
+        table.reciprocal[i] = (uint32_t)(((1ull << table.shift[i]) + q - 1) / q);
+    }
+}
+
+void quantizeCoefficients(const coefficient *input, coefficient *output, int count, const QuantTable &table) {
+    for (int b = 0; b < count; b++, input += 64, output += 64) {
+        for (int i = 0; i < 64; i++) {
+            output[i] = quantizeValue(input[i], table.reciprocal[i], table.shift[i]);
+        }
+    }
+}
+
+void dequantizeCoefficients(const coefficient *input, coefficient *output, int count, const QuantTable &table) {
+    for (int b = 0; b < count; b++, input += 64, output += 64) {
+        for (int i = 0; i < 64; i++) {
+            output[i] = input[i] * table.divisor[i];
+        }
+    }
+}
+
+// scaledIdctBasis()
+// Description: Basis of the size-point reduced inverse DCT, basis[u * size + x] = C(u) cos((2x + 1)
+//              u pi / 2 size) with the 8-point factors C(0) = 1 / sqrt(8), C(u) = 1 / 2
+static const float* scaledIdctBasis(int size) {
+    struct Bases {
+        float table[4][64];
+        Bases() {
+            const double pi = 3.14159265358979323846;
+            for (int level = 0, n = 1; n <= 8; level++, n *= 2) {
+                for (int u = 0; u < n; u++) {
+                    for (int x = 0; x < n; x++) {
+                        const double factor = u == 0 ? std::sqrt(0.125) : 0.5;
+                        table[level][u * n + x] = (float)(factor * std::cos((2 * x + 1) * u * pi / (2 * n)));
+                    }
+                }
+            }
+        }
+    };
+    static const Bases bases;
+    return bases.table[size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3];
+}
+
+void inverseDctBlocksScaled(const coefficient *coefficients, coefficient *output, int count, int size, const QuantTable *quant) {
+    const float *basis = scaledIdctBasis(size);
+    float dequantized[64];
+    float rows[64];
+
+    for (int b = 0; b < count; b++, coefficients += 64, output += size * size) {
+        for (int u = 0; u < size; u++) {
+            for (int v = 0; v < size; v++) {
+                const coefficient c = coefficients[u * 8 + v];
+                dequantized[u * size + v] = (float)(quant ? c * quant->divisor[u * 8 + v] : c);
+            }
+        }
+
+        // Horizontal pass (coefficient rows to sample columns), then the vertical pass
+        for (int u = 0; u < size; u++) {
+            for (int y = 0; y < size; y++) {
+                float sum = 0.0f;
+                for (int v = 0; v < size; v++) sum += dequantized[u * size + v] * basis[v * size + y];
+                rows[u * size + y] = sum;
+            }
+        }
+        for (int x = 0; x < size; x++) {
+            for (int y = 0; y < size; y++) {
+                float sum = 0.0f;
+                for (int u = 0; u < size; u++) sum += basis[u * size + x] * rows[u * size + y];
+                output[x * size + y] = toCoefficient(sum);
+            }
+        }
+    }
+}
+
+const unsigned char zigzagIndex[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+int lastNonzeroZigzag(const coefficient *block) {
+    int i = 63;
+    while (i >= 0 && block[zigzagIndex[i]] == 0) i--;
+    return i;
+}
+
+IdctClass idctClass(int lastNonzero) {
+    // Zigzag positions 0-9 are exactly the top-left anti-diagonals up to (3, 0), all inside 4x4
+    if (lastNonzero <= 0) return IdctClass::DCOnly;
+    if (lastNonzero <= 9) return IdctClass::Sparse4x4;
+    return IdctClass::Full;
+}
+
+// dcOnlySample()
+// Description: Value of every sample of a block whose only nonzero coefficient is the DC. Both
+//              passes reduce to a scale of the DC, so this is the constant the full transforms give
+static coefficient dcOnlySample(coefficient dc, DctMode mode) {
+    if (mode == DctMode::Integer) {
+        return descale<DCT_CONST_BITS + DCT_PASS1_BITS + DCT_SCALE_BITS>(shiftLeft<DCT_CONST_BITS + DCT_PASS1_BITS>(dc));
+    }
+    return toCoefficient((static_cast<float>(dc) * idctS0) * idctS0);
+}
+
+void inverseDctBlocks(const coefficient *coefficients, coefficient *output, int count, DctKernel kernel, DctMode mode) {
+    const bool integer = mode == DctMode::Integer;
+
+    for (int b = 0; b < count; b++, coefficients += 64, output += 64) {
+        IdctClass cls = idctClass(lastNonzeroZigzag(coefficients));
+
+        if (cls == IdctClass::DCOnly) {
+            const coefficient value = dcOnlySample(coefficients[0], mode);
+            for (int i = 0; i < 64; i++) output[i] = value;
+            continue;
+        }
+
+        switch (kernel) {
+            case DctKernel::AVX2:
+                inverseDctBlockAvx2(coefficients, output, cls, mode);
+                break;
+#ifdef JPEG_DCT_SSE2
+            case DctKernel::SSE2:
+                if (integer) inverseDctBlockSse2<I4>(coefficients, output, cls);
+                else inverseDctBlockSse2<F4>(coefficients, output, cls);
+                break;
+#endif
+            default:
+                if (integer) inverseDctBlockScalar<int32_t>(coefficients, output, cls);
+                else inverseDctBlockScalar<float>(coefficients, output, cls);
+                break;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+
+// Coefficient type stored in the coefficient planes
+typedef int32_t coefficient;
+
+// DCT engine
+// Transforms batches of 8x8 blocks (64 contiguous samples per block, row-major). The kernel is
+// picked at runtime from what the CPU supports; every kernel runs the same butterflies with the
+// same operations in the same order, so all of them produce bit-identical coefficients
+// (tolerance 0) and are interchangeable with the scalar path.
+enum class DctKernel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Arithmetic of the transforms. Both modes produce coefficients at the same scale, so they share
+// the quantization tables and the file format.
+enum class DctMode {
+    Float,  // AAN float transform
+    Integer // 13-bit fixed-point transform (libjpeg islow), deterministic across compilers
+};
+
+// QuantTable
+// One quantization table (row-major) with its precomputed reciprocals. Quantizing is a truncating
+// division c / q; it is done as (|c| * reciprocal) >> shift, which is exact for |c| < 2^15 (DCT
+// coefficients of 8-bit samples stay within +-2048)
+typedef struct QuantTable {
+    int32_t divisor[64];
+    uint32_t reciprocal[64];
+    uint32_t shift[64];
+} QuantTable;
+
+// buildQuantTable()
+// Description: Fills a QuantTable from an 8x8 table of quantization steps
+// Input: const int steps[8][8] - quantization steps (>= 1)
+//        QuantTable &table - table to fill
+// Output: No return value, modifies the table
+void buildQuantTable(const int steps[8][8], QuantTable &table);
+
+// quantizeCoefficients() / dequantizeCoefficients()
+// Description: Quantize (truncating division) or dequantize (multiplication) count blocks; input
+//              and output may be the same buffer
+void quantizeCoefficients(const coefficient *input, coefficient *output, int count, const QuantTable &table);
+void dequantizeCoefficients(const coefficient *input, coefficient *output, int count, const QuantTable &table);
+
+// Kernel selection
+DctKernel detectDctKernel();
+bool dctKernelSupported(DctKernel kernel);
+const char* dctKernelName(DctKernel kernel);
+
+// forwardDctBlocks()
+// Description: Applies the forward DCT II to count blocks of samples
+// Input: const coefficient *samples - count * 64 samples, block after block
+//        coefficient *output - count * 64 coefficients, block after block
+//        int count - number of blocks (batches of 8 keep the SIMD kernels busy)
+//        DctKernel kernel - kernel to use, must be supported
+//        DctMode mode - float or integer arithmetic
+//        const QuantTable *quant - if given, the coefficients are quantized as they are stored
+// Output: No return value, writes the rounded (and quantized) DCT coefficients to output
+void forwardDctBlocks(const coefficient *samples, coefficient *output, int count, DctKernel kernel, DctMode mode,
+                      const QuantTable *quant = nullptr);
+
+// Row-major index of each zigzag position
+extern const unsigned char zigzagIndex[64];
+
+// Inverse DCT block classes, from the last nonzero coefficient in zigzag order
+enum class IdctClass {
+    DCOnly,    // Only the DC coefficient can be nonzero - the block is a constant fill
+    Sparse4x4, // Nonzero coefficients within the top-left 4x4 - reduced kernel
+    Full
+};
+
+// lastNonzeroZigzag()
+// Description: Finds the zigzag index of the last nonzero coefficient of a block
+// Input: const coefficient *block - 64 coefficients in row-major order
+// Output: int - zigzag index of the last nonzero coefficient, -1 if the block is all zero
+int lastNonzeroZigzag(const coefficient *block);
+
+// idctClass()
+// Description: Classifies a block from the zigzag index of its last nonzero coefficient
+IdctClass idctClass(int lastNonzero);
+
+// inverseDctBlocks()
+// Description: Applies the inverse DCT II to count blocks, using the cheapest path for each block
+// Input: const coefficient *coefficients - count * 64 coefficients, block after block
+//        coefficient *output - count * 64 samples, block after block
+//        int count - number of blocks
+//        DctKernel kernel - kernel to use for the sparse and full blocks, must be supported
+//        DctMode mode - float or integer arithmetic
+// Output: No return value, writes the rounded samples to output
+void inverseDctBlocks(const coefficient *coefficients, coefficient *output, int count, DctKernel kernel, DctMode mode);
+
+// inverseDctBlocksScaled()
+// Description: Reduced inverse DCT giving each block as size x size samples from its top-left size x
+//              size coefficients: a size-point inverse DCT with the 8-point normalization, so every
+//              sample is about the mean of the 8 / size square it covers. At size 1 that is the DC
+//              alone, at size 8 a plain (slow, float) inverse DCT
+// Input: const coefficient *coefficients - count * 64 coefficients, block after block
+//        coefficient *output - count * size * size samples, block after block (row-major)
+//        int count - number of blocks
+//        int size - 1, 2, 4 or 8
+//        const QuantTable *quant - if given, the coefficients are dequantized as they are read
+// Output: No return value, writes the rounded samples to output
+void inverseDctBlocksScaled(const coefficient *coefficients, coefficient *output, int count, int size, const QuantTable *quant = nullptr);
+
+// Per-instruction-set entry points (JpegDctAvx2.cpp is compiled with AVX2 enabled)
+bool avx2DctCompiled();
+void forwardDctBlocksAvx2(const coefficient *samples, coefficient *output, int count, DctMode mode, const QuantTable *quant);
+void inverseDctBlockAvx2(const coefficient *coefficients, coefficient *output, IdctClass cls, DctMode mode);
@@ -0,0 +1,231 @@
+// AVX2 DCT kernels. This file is compiled with AVX2 code generation enabled (see CMakeLists.txt)
+// and only runs after detectDctKernel() has checked the CPU, so it must stay free of library
+// code that could be shared with the rest of the program.
+#include "JpegDct.h"
+#include "JpegDctKernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace {
+
+// Eight float lanes with the operators the butterflies need
+struct F8 {
+    __m256 v;
+    F8() = default;
+    F8(__m256 x) : v(x) {}
+    F8(float f) : v(_mm256_set1_ps(f)) {}
+};
+
+inline F8 operator+(F8 a, F8 b) { return _mm256_add_ps(a.v, b.v); }
+inline F8 operator-(F8 a, F8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline F8 operator*(F8 a, F8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline F8 operator-(F8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+// Eight int32 lanes with the operators the integer butterflies need
+struct I8 {
+    __m256i v;
+    I8() = default;
+    I8(__m256i x) : v(x) {}
+    I8(int32_t i) : v(_mm256_set1_epi32(i)) {}
+};
+
+inline I8 operator+(I8 a, I8 b) { return _mm256_add_epi32(a.v, b.v); }
+inline I8 operator-(I8 a, I8 b) { return _mm256_sub_epi32(a.v, b.v); }
+inline I8 operator*(I8 a, I8 b) { return _mm256_mullo_epi32(a.v, b.v); }
+
+template <int n>
+inline I8 shiftLeft(I8 x) {
+    return _mm256_slli_epi32(x.v, n);
+}
+
+template <int n>
+inline I8 descale(I8 x) {
+    return _mm256_srai_epi32(_mm256_add_epi32(x.v, _mm256_set1_epi32(1 << (n - 1))), n);
+}
+
+template <bool FirstPass> inline void forwardPass(F8 x[8]) { fdctPass(x); }
+template <bool FirstPass> inline void forwardPass(I8 x[8]) { fdctPassInt<I8, FirstPass>(x); }
+template <bool FirstPass> inline void inversePass(F8 x[8]) { idctPass(x); }
+template <bool FirstPass> inline void inversePass(I8 x[8]) { idctPassInt<I8, FirstPass>(x); }
+template <bool FirstPass> inline void inversePassSparse(F8 x[8]) { idctPassSparse(x); }
+template <bool FirstPass> inline void inversePassSparse(I8 x[8]) { idctPassIntSparse<I8, FirstPass>(x); }
+
+inline void load(F8 &x, const coefficient *p) {
+    x = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)p));
+}
+
+inline void load(I8 &x, const coefficient *p) {
+    x = _mm256_loadu_si256((const __m256i*)p);
+}
+
+// Matches std::round(x + 0.5f) of the scalar kernel (round half away from zero)
+inline __m256i roundToCoefficients(__m256 x) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 y = _mm256_add_ps(x, _mm256_set1_ps(0.5f));
+    const __m256 truncated = _mm256_round_ps(y, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m256 fraction = _mm256_andnot_ps(signMask, _mm256_sub_ps(y, truncated));
+    const __m256 step = _mm256_or_ps(_mm256_and_ps(y, signMask), _mm256_set1_ps(1.0f));
+    const __m256 half = _mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+    return _mm256_cvttps_epi32(_mm256_add_ps(truncated, _mm256_and_ps(half, step)));
+}
+
+inline __m256i toCoefficients(F8 x) {
+    return roundToCoefficients(x.v);
+}
+
+inline __m256i toCoefficients(I8 x) {
+    return x.v;
+}
+
+template <typename L>
+inline void store(coefficient *p, L x) {
+    _mm256_storeu_si256((__m256i*)p, toCoefficients(x));
+}
+
+// Stores eight coefficients divided (truncating) by their quantization steps: the magnitudes are
+// multiplied by the reciprocals and shifted per lane, then the signs are restored
+template <typename L>
+inline void storeQuantized(coefficient *p, L x, const uint32_t *reciprocal, const uint32_t *shift) {
+    const __m256i c = toCoefficients(x);
+    const __m256i magnitude = _mm256_abs_epi32(c);
+    const __m256i product = _mm256_mullo_epi32(magnitude, _mm256_loadu_si256((const __m256i*)reciprocal));
+    const __m256i quotient = _mm256_srlv_epi32(product, _mm256_loadu_si256((const __m256i*)shift));
+    _mm256_storeu_si256((__m256i*)p, _mm256_sign_epi32(quotient, c));
+}
+
+// Transposes the 8x8 block held in r[0..7] (one row per register)
+inline void transpose8(F8 *r) {
+    const __m256 t0 = _mm256_unpacklo_ps(r[0].v, r[1].v);
+    const __m256 t1 = _mm256_unpackhi_ps(r[0].v, r[1].v);
+    const __m256 t2 = _mm256_unpacklo_ps(r[2].v, r[3].v);
+    const __m256 t3 = _mm256_unpackhi_ps(r[2].v, r[3].v);
+    const __m256 t4 = _mm256_unpacklo_ps(r[4].v, r[5].v);
+    const __m256 t5 = _mm256_unpackhi_ps(r[4].v, r[5].v);
+    const __m256 t6 = _mm256_unpacklo_ps(r[6].v, r[7].v);
+    const __m256 t7 = _mm256_unpackhi_ps(r[6].v, r[7].v);
+
+    const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    const __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+    r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+    r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+    r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+    r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+    r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+    r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+    r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+// The integer lanes reuse the float shuffles (the casts are free)
+inline void transpose8(I8 *r) {
+    F8 f[8];
+    for (int k = 0; k < 8; k++) f[k] = _mm256_castsi256_ps(r[k].v);
+    transpose8(f);
+    for (int k = 0; k < 8; k++) r[k] = _mm256_castps_si256(f[k].v);
+}
+
+// forwardDctBlocksAvx2Lanes()
+// Description: Forward DCT with one block row per register - the vertical pass runs on all eight
+//              columns at once, the horizontal pass on the transposed block (L is F8 or I8)
+template <typename L>
+void forwardDctBlocksAvx2Lanes(const coefficient *samples, coefficient *output, int count, const QuantTable *quant) {
+    for (int b = 0; b < count; b++, samples += 64, output += 64) {
+        L rows[8];
+        for (int k = 0; k < 8; k++) {
+            load(rows[k], samples + k * 8);
+        }
+
+        forwardPass<true>(rows);
+        transpose8(rows);
+        forwardPass<false>(rows);
+        transpose8(rows);
+
+        if (quant) {
+            for (int k = 0; k < 8; k++) {
+                storeQuantized(output + k * 8, rows[k], quant->reciprocal + k * 8, quant->shift + k * 8);
+            }
+        } else {
+            for (int k = 0; k < 8; k++) {
+                store(output + k * 8, rows[k]);
+            }
+        }
+    }
+}
+
+// inverseDctBlockAvx2Lanes()
+// Description: Inverse DCT of one block with one block row per register. In a sparse block only
+//              rows 0-3 are loaded, and after the vertical pass columns 4-7 are still zero, so both
+//              passes use the sparse butterfly
+template <typename L>
+void inverseDctBlockAvx2Lanes(const coefficient *coefficients, coefficient *output, IdctClass cls) {
+    L rows[8];
+
+    if (cls == IdctClass::Sparse4x4) {
+        for (int k = 0; k < 4; k++) {
+            load(rows[k], coefficients + k * 8);
+        }
+        inversePassSparse<true>(rows);
+        transpose8(rows);
+        inversePassSparse<false>(rows);
+    } else {
+        for (int k = 0; k < 8; k++) {
+            load(rows[k], coefficients + k * 8);
+        }
+        inversePass<true>(rows);
+        transpose8(rows);
+        inversePass<false>(rows);
+    }
+    transpose8(rows);
+
+    for (int k = 0; k < 8; k++) {
+        store(output + k * 8, rows[k]);
+    }
+}
+
+}
+
+bool avx2DctCompiled() {
+    return true;
+}
+
+void forwardDctBlocksAvx2(const coefficient *samples, coefficient *output, int count, DctMode mode, const QuantTable *quant) {
+    if (mode == DctMode::Integer) forwardDctBlocksAvx2Lanes<I8>(samples, output, count, quant);
+    else forwardDctBlocksAvx2Lanes<F8>(samples, output, count, quant);
+}
+
+void inverseDctBlockAvx2(const coefficient *coefficients, coefficient *output, IdctClass cls, DctMode mode) {
+    if (mode == DctMode::Integer) inverseDctBlockAvx2Lanes<I8>(coefficients, output, cls);
+    else inverseDctBlockAvx2Lanes<F8>(coefficients, output, cls);
+}
+
+#else
+
+// Built without AVX2 code generation - detectDctKernel() never selects these
+bool avx2DctCompiled() {
+    return false;
+}
+
+void forwardDctBlocksAvx2(const coefficient *samples, coefficient *output, int count, DctMode mode, const QuantTable *quant) {
+    (void)samples;
+    (void)output;
+    (void)count;
+    (void)mode;
+    (void)quant;
+}
+
+void inverseDctBlockAvx2(const coefficient *coefficients, coefficient *output, IdctClass cls, DctMode mode) {
+    (void)coefficients;
+    (void)output;
+    (void)cls;
+    (void)mode;
+}
+
+#endif
@@ -0,0 +1,451 @@
+#pragma once
+#include <cstdint>
+
+// Butterflies shared by the scalar and SIMD DCT kernels. Each kernel instantiates them with its
+// own lane type (plain float/int32_t for the scalar kernel, wrappers around __m128/__m256 for
+// SSE2/AVX2), which keeps the arithmetic of every kernel identical to the scalar path.
+// This header is included by the AVX2 translation unit, so it must not pull in any library code.
+
+// Forward DCT constants
+static const float fdctA1 = 0.707;
+static const float fdctA2 = 0.541;
+static const float fdctA3 = 0.707;
+static const float fdctA4 = 1.307;
+static const float fdctA5 = 0.383;
+
+static const float fdctS0 = 0.353553;
+static const float fdctS1 = 0.254898;
+static const float fdctS2 = 0.270598;
+static const float fdctS3 = 0.300672;
+static const float fdctS4 = fdctS0;
+static const float fdctS5 = 0.449988;
+static const float fdctS6 = 0.653281;
+static const float fdctS7 = 1.281458;
+
+// fdctPass()
+// Description: One 1-D pass of the forward AAN DCT over 8 lanes (x[k] is the k-th sample of each
+//              lane), used for the vertical pass on rows and the horizontal pass on columns
+// Input: V x[8] - samples, V being float or a SIMD float wrapper
+// Output: No return value, x[k] holds the k-th scaled DCT coefficient of each lane
+template <typename V>
+static inline void fdctPass(V x[8]) {
+    const V a1(fdctA1), a2(fdctA2), a3(fdctA3), a4(fdctA4), a5(fdctA5);
+    const V s0(fdctS0), s1(fdctS1), s2(fdctS2), s3(fdctS3);
+    const V s4(fdctS4), s5(fdctS5), s6(fdctS6), s7(fdctS7);
+
+    const V b0 = x[0] + x[7];
+    const V b1 = x[1] + x[6];
+    const V b2 = x[2] + x[5];
+    const V b3 = x[3] + x[4];
+    const V b4 =-x[4] + x[3];
+    const V b5 =-x[5] + x[2];
+    const V b6 =-x[6] + x[1];
+    const V b7 =-x[7] + x[0];
+
+    const V c0 = b0 + b3;
+    const V c1 = b1 + b2;
+    const V c2 =-b2 + b1;
+    const V c3 =-b3 + b0;
+    const V c4 =-b4 - b5;
+    const V c5 = b5 + b6;
+    const V c6 = b6 + b7;
+    const V c7 = b7;
+
+    const V d0 = c0 + c1;
+    const V d1 =-c1 + c0;
+    const V d2 = c2 + c3;
+    const V d3 = c3;
+    const V d4 = c4;
+    const V d5 = c5;
+    const V d6 = c6;
+    const V d7 = c7;
+    const V d8 = (d4+d6) * a5;
+
+    const V e0 = d0;
+    const V e1 = d1;
+    const V e2 = d2 * a1;
+    const V e3 = d3;
+    const V e4 = -d4 * a2 - d8;
+    const V e5 = d5 * a3;
+    const V e6 = d6 * a4 - d8;
+    const V e7 = d7;
+
+    const V f0 = e0;
+    const V f1 = e1;
+    const V f2 = e2 + e3;
+    const V f3 = e3 - e2;
+    const V f4 = e4;
+    const V f5 = e5 + e7;
+    const V f6 = e6;
+    const V f7 = e7 - e5;
+
+    const V g0 = f0;
+    const V g1 = f1;
+    const V g2 = f2;
+    const V g3 = f3;
+    const V g4 = f4 + f7;
+    const V g5 = f5 + f6;
+    const V g6 = -f6 + f5;
+    const V g7 = f7 - f4;
+
+    x[0] = g0 * s0;
+    x[4] = g1 * s4;
+    x[2] = g2 * s2;
+    x[6] = g3 * s6;
+    x[5] = g4 * s5;
+    x[1] = g5 * s1;
+    x[7] = g6 * s7;
+    x[3] = g7 * s3;
+}
+
+// Inverse DCT constants (float values of 2cos(k*pi/8) and the AAN output scales cos(k*pi/16)/2),
+// spelled out as literals so that no kernel translation unit needs dynamic initialization
+static const float idctM0 = 1.84775901f;  // 2cos(pi/8)
+static const float idctM1 = 1.41421354f;  // 2cos(pi/4)
+static const float idctM3 = idctM1;
+static const float idctM5 = 0.765366852f; // 2cos(3pi/8)
+static const float idctM2 = 1.08239222f;  // m0 - m5
+static const float idctM4 = 2.6131258f;   // m0 + m5
+
+static const float idctS0 = 0.353553385f;
+static const float idctS1 = 0.490392625f;
+static const float idctS2 = 0.461939752f;
+static const float idctS3 = 0.415734798f;
+static const float idctS4 = 0.353553385f;
+static const float idctS5 = 0.277785122f;
+static const float idctS6 = 0.191341713f;
+static const float idctS7 = 0.0975451618f;
+
+// idctPass()
+// Description: One 1-D pass of the inverse AAN DCT over 8 lanes (x[k] is the k-th coefficient of
+//              each lane)
+// Input: V x[8] - scaled DCT coefficients, V being float or a SIMD float wrapper
+// Output: No return value, x[k] holds the k-th sample of each lane
+template <typename V>
+static inline void idctPass(V x[8]) {
+    const V m1(idctM1), m2(idctM2), m3(idctM3), m4(idctM4), m5(idctM5);
+
+    const V g0 = x[0] * V(idctS0);
+    const V g1 = x[4] * V(idctS4);
+    const V g2 = x[2] * V(idctS2);
+    const V g3 = x[6] * V(idctS6);
+    const V g4 = x[5] * V(idctS5);
+    const V g5 = x[1] * V(idctS1);
+    const V g6 = x[7] * V(idctS7);
+    const V g7 = x[3] * V(idctS3);
+
+    const V f0 = g0;
+    const V f1 = g1;
+    const V f2 = g2;
+    const V f3 = g3;
+    const V f4 = g4 - g7;
+    const V f5 = g5 + g6;
+    const V f6 = g5 - g6;
+    const V f7 = g4 + g7;
+
+    const V e0 = f0;
+    const V e1 = f1;
+    const V e2 = f2 - f3;
+    const V e3 = f2 + f3;
+    const V e4 = f4;
+    const V e5 = f5 - f7;
+    const V e6 = f6;
+    const V e7 = f5 + f7;
+    const V e8 = f4 + f6;
+
+    const V d0 = e0;
+    const V d1 = e1;
+    const V d2 = e2 * m1;
+    const V d3 = e3;
+    const V d4 = e4 * m2;
+    const V d5 = e5 * m3;
+    const V d6 = e6 * m4;
+    const V d7 = e7;
+    const V d8 = e8 * m5;
+
+    const V c0 = d0 + d1;
+    const V c1 = d0 - d1;
+    const V c2 = d2 - d3;
+    const V c3 = d3;
+    const V c4 = d4 + d8;
+    const V c5 = d5 + d7;
+    const V c6 = d6 - d8;
+    const V c7 = d7;
+    const V c8 = c5 - c6;
+
+    const V b0 = c0 + c3;
+    const V b1 = c1 + c2;
+    const V b2 = c1 - c2;
+    const V b3 = c0 - c3;
+    const V b4 = c4 - c8;
+    const V b5 = c8;
+    const V b6 = c6 - c7;
+    const V b7 = c7;
+
+    x[0] = b0 + b7;
+    x[1] = b1 + b6;
+    x[2] = b2 + b5;
+    x[3] = b3 + b4;
+    x[4] = b3 - b4;
+    x[5] = b2 - b5;
+    x[6] = b1 - b6;
+    x[7] = b0 - b7;
+}
+
+// idctPassSparse()
+// Description: idctPass() for lanes whose coefficients 4-7 are zero. The terms those coefficients
+//              feed are dropped; every remaining operation is the one idctPass() performs, so the
+//              result is identical (up to the sign of zero, which rounding ignores)
+// Input: V x[8] - scaled DCT coefficients, x[4..7] are ignored and treated as zero
+// Output: No return value, x[k] holds the k-th sample of each lane
+template <typename V>
+static inline void idctPassSparse(V x[8]) {
+    const V m1(idctM1), m2(idctM2), m3(idctM3), m4(idctM4), m5(idctM5);
+
+    const V g0 = x[0] * V(idctS0);
+    const V g2 = x[2] * V(idctS2);
+    const V g5 = x[1] * V(idctS1);
+    const V g7 = x[3] * V(idctS3);
+
+    const V e5 = g5 - g7;
+    const V e7 = g5 + g7;
+
+    const V d2 = g2 * m1;
+    const V d4 = -g7 * m2;
+    const V d5 = e5 * m3;
+    const V d6 = g5 * m4;
+    const V d8 = e5 * m5;
+
+    const V c2 = d2 - g2;
+    const V c4 = d4 + d8;
+    const V c5 = d5 + e7;
+    const V c6 = d6 - d8;
+    const V c8 = c5 - c6;
+
+    const V b0 = g0 + g2;
+    const V b1 = g0 + c2;
+    const V b2 = g0 - c2;
+    const V b3 = g0 - g2;
+    const V b4 = c4 - c8;
+    const V b6 = c6 - e7;
+
+    x[0] = b0 + e7;
+    x[1] = b1 + b6;
+    x[2] = b2 + c8;
+    x[3] = b3 + b4;
+    x[4] = b3 - b4;
+    x[5] = b2 - c8;
+    x[6] = b1 - b6;
+    x[7] = b0 - e7;
+}
+
+// Integer DCT
+// 13-bit fixed-point transforms after libjpeg's islow DCT (jfdctint.c / jidctint.c). Integer
+// arithmetic is exact, so every kernel and every compiler produces the same coefficients.
+static const int DCT_CONST_BITS = 13;
+static const int DCT_PASS1_BITS = 2;
+// libjpeg's transforms are scaled up by 8; the extra descale keeps the coefficients at the scale of
+// the float path, so quantization tables and files are shared by both modes
+static const int DCT_SCALE_BITS = 3;
+
+static const int32_t FIX_0_298631336 = 2446;
+static const int32_t FIX_0_390180644 = 3196;
+static const int32_t FIX_0_541196100 = 4433;
+static const int32_t FIX_0_765366865 = 6270;
+static const int32_t FIX_0_899976223 = 7373;
+static const int32_t FIX_1_175875602 = 9633;
+static const int32_t FIX_1_501321110 = 12299;
+static const int32_t FIX_1_847759065 = 15137;
+static const int32_t FIX_1_961570560 = 16069;
+static const int32_t FIX_2_053119869 = 16819;
+static const int32_t FIX_2_562915447 = 20995;
+static const int32_t FIX_3_072711026 = 25172;
+
+// Shifts for the scalar lanes; the SIMD lane types provide their own overloads
+template <int n>
+static inline int32_t shiftLeft(int32_t x) {
+    return x * (1 << n);
+}
+
+// Divides by 2^n, rounding halves up
+template <int n>
+static inline int32_t descale(int32_t x) {
+    return (x + (1 << (n - 1))) >> n;
+}
+
+// fdctPassInt()
+// Description: One 1-D pass of the forward integer DCT over 8 lanes
+// Input: I x[8] - samples (first pass) or first pass output, I being int32_t or a SIMD wrapper
+// Output: No return value, x[k] holds the k-th DCT coefficient of each lane
+template <typename I, bool FirstPass>
+static inline void fdctPassInt(I x[8]) {
+    constexpr int bits = FirstPass ? DCT_CONST_BITS - DCT_PASS1_BITS : DCT_CONST_BITS + DCT_PASS1_BITS + DCT_SCALE_BITS;
+
+    const I tmp0 = x[0] + x[7];
+    I tmp7 = x[0] - x[7];
+    const I tmp1 = x[1] + x[6];
+    I tmp6 = x[1] - x[6];
+    const I tmp2 = x[2] + x[5];
+    I tmp5 = x[2] - x[5];
+    const I tmp3 = x[3] + x[4];
+    I tmp4 = x[3] - x[4];
+
+    // Even part
+    const I tmp10 = tmp0 + tmp3;
+    const I tmp13 = tmp0 - tmp3;
+    const I tmp11 = tmp1 + tmp2;
+    const I tmp12 = tmp1 - tmp2;
+
+    if (FirstPass) {
+        x[0] = shiftLeft<DCT_PASS1_BITS>(tmp10 + tmp11);
+        x[4] = shiftLeft<DCT_PASS1_BITS>(tmp10 - tmp11);
+    } else {
+        x[0] = descale<DCT_PASS1_BITS + DCT_SCALE_BITS>(tmp10 + tmp11);
+        x[4] = descale<DCT_PASS1_BITS + DCT_SCALE_BITS>(tmp10 - tmp11);
+    }
+
+    const I z1 = (tmp12 + tmp13) * I(FIX_0_541196100);
+    x[2] = descale<bits>(z1 + tmp13 * I(FIX_0_765366865));
+    x[6] = descale<bits>(z1 - tmp12 * I(FIX_1_847759065));
+
+    // Odd part
+    I z2 = tmp5 + tmp6;
+    I z3 = tmp4 + tmp6;
+    I z4 = tmp5 + tmp7;
+    const I z5 = (z3 + z4) * I(FIX_1_175875602);
+    const I z1Odd = (tmp4 + tmp7) * I(-FIX_0_899976223);
+
+    tmp4 = tmp4 * I(FIX_0_298631336);
+    tmp5 = tmp5 * I(FIX_2_053119869);
+    tmp6 = tmp6 * I(FIX_3_072711026);
+    tmp7 = tmp7 * I(FIX_1_501321110);
+    z2 = z2 * I(-FIX_2_562915447);
+    z3 = z3 * I(-FIX_1_961570560) + z5;
+    z4 = z4 * I(-FIX_0_390180644) + z5;
+
+    x[7] = descale<bits>(tmp4 + z1Odd + z3);
+    x[5] = descale<bits>(tmp5 + z2 + z4);
+    x[3] = descale<bits>(tmp6 + z2 + z3);
+    x[1] = descale<bits>(tmp7 + z1Odd + z4);
+}
+
+// idctPassInt()
+// Description: One 1-D pass of the inverse integer DCT over 8 lanes
+// Input: I x[8] - DCT coefficients (first pass) or first pass output
+// Output: No return value, x[k] holds the k-th sample of each lane
+template <typename I, bool FirstPass>
+static inline void idctPassInt(I x[8]) {
+    constexpr int bits = FirstPass ? DCT_CONST_BITS - DCT_PASS1_BITS : DCT_CONST_BITS + DCT_PASS1_BITS + DCT_SCALE_BITS;
+
+    // Even part
+    const I z1 = (x[2] + x[6]) * I(FIX_0_541196100);
+    const I tmp2 = z1 - x[6] * I(FIX_1_847759065);
+    const I tmp3 = z1 + x[2] * I(FIX_0_765366865);
+    const I tmp0 = shiftLeft<DCT_CONST_BITS>(x[0] + x[4]);
+    const I tmp1 = shiftLeft<DCT_CONST_BITS>(x[0] - x[4]);
+
+    const I tmp10 = tmp0 + tmp3;
+    const I tmp13 = tmp0 - tmp3;
+    const I tmp11 = tmp1 + tmp2;
+    const I tmp12 = tmp1 - tmp2;
+
+    // Odd part
+    I odd0 = x[7];
+    I odd1 = x[5];
+    I odd2 = x[3];
+    I odd3 = x[1];
+
+    const I z5 = (odd0 + odd2 + odd1 + odd3) * I(FIX_1_175875602);
+    const I zOdd1 = (odd0 + odd3) * I(-FIX_0_899976223);
+    const I zOdd2 = (odd1 + odd2) * I(-FIX_2_562915447);
+    const I zOdd3 = (odd0 + odd2) * I(-FIX_1_961570560) + z5;
+    const I zOdd4 = (odd1 + odd3) * I(-FIX_0_390180644) + z5;
+
+    odd0 = odd0 * I(FIX_0_298631336) + zOdd1 + zOdd3;
+    odd1 = odd1 * I(FIX_2_053119869) + zOdd2 + zOdd4;
+    odd2 = odd2 * I(FIX_3_072711026) + zOdd2 + zOdd3;
+    odd3 = odd3 * I(FIX_1_501321110) + zOdd1 + zOdd4;
+
+    x[0] = descale<bits>(tmp10 + odd3);
+    x[7] = descale<bits>(tmp10 - odd3);
+    x[1] = descale<bits>(tmp11 + odd2);
+    x[6] = descale<bits>(tmp11 - odd2);
+    x[2] = descale<bits>(tmp12 + odd1);
+    x[5] = descale<bits>(tmp12 - odd1);
+    x[3] = descale<bits>(tmp13 + odd0);
+    x[4] = descale<bits>(tmp13 - odd0);
+}
+
+// idctPassIntSparse()
+// Description: idctPassInt() for lanes whose coefficients 4-7 are zero. Integer arithmetic is
+//              exact, so dropping the zero terms gives the same result as the full pass
+// Input: I x[8] - DCT coefficients, x[4..7] are ignored and treated as zero
+// Output: No return value, x[k] holds the k-th sample of each lane
+template <typename I, bool FirstPass>
+static inline void idctPassIntSparse(I x[8]) {
+    constexpr int bits = FirstPass ? DCT_CONST_BITS - DCT_PASS1_BITS : DCT_CONST_BITS + DCT_PASS1_BITS + DCT_SCALE_BITS;
+
+    // Even part
+    const I z1 = x[2] * I(FIX_0_541196100);
+    const I tmp3 = z1 + x[2] * I(FIX_0_765366865);
+    const I tmp0 = shiftLeft<DCT_CONST_BITS>(x[0]);
+
+    const I tmp10 = tmp0 + tmp3;
+    const I tmp13 = tmp0 - tmp3;
+    const I tmp11 = tmp0 + z1;
+    const I tmp12 = tmp0 - z1;
+
+    // Odd part
+    const I z5 = (x[3] + x[1]) * I(FIX_1_175875602);
+    const I zOdd1 = x[1] * I(-FIX_0_899976223);
+    const I zOdd2 = x[3] * I(-FIX_2_562915447);
+    const I zOdd3 = x[3] * I(-FIX_1_961570560) + z5;
+    const I zOdd4 = x[1] * I(-FIX_0_390180644) + z5;
+
+    const I odd0 = zOdd1 + zOdd3;
+    const I odd1 = zOdd2 + zOdd4;
+    const I odd2 = x[3] * I(FIX_3_072711026) + zOdd2 + zOdd3;
+    const I odd3 = x[1] * I(FIX_1_501321110) + zOdd1 + zOdd4;
+
+    x[0] = descale<bits>(tmp10 + odd3);
+    x[7] = descale<bits>(tmp10 - odd3);
+    x[1] = descale<bits>(tmp11 + odd2);
+    x[6] = descale<bits>(tmp11 - odd2);
+    x[2] = descale<bits>(tmp12 + odd1);
+    x[5] = descale<bits>(tmp12 - odd1);
+    x[3] = descale<bits>(tmp13 + odd0);
+    x[4] = descale<bits>(tmp13 - odd0);
+}
+
+// Pass selectors
+// Let one kernel body serve both modes: float lanes run the AAN butterflies, integer lanes the
+// fixed-point ones. The SIMD lane types provide matching overloads.
+template <bool FirstPass>
+static inline void forwardPass(float x[8]) {
+    fdctPass(x);
+}
+
+template <bool FirstPass>
+static inline void forwardPass(int32_t x[8]) {
+    fdctPassInt<int32_t, FirstPass>(x);
+}
+
+template <bool FirstPass>
+static inline void inversePass(float x[8]) {
+    idctPass(x);
+}
+
+template <bool FirstPass>
+static inline void inversePass(int32_t x[8]) {
+    idctPassInt<int32_t, FirstPass>(x);
+}
+
+template <bool FirstPass>
+static inline void inversePassSparse(float x[8]) {
+    idctPassSparse(x);
+}
+
+template <bool FirstPass>
+static inline void inversePassSparse(int32_t x[8]) {
+    idctPassIntSparse<int32_t, FirstPass>(x);
+}
@@ -0,0 +1,156 @@
+#include "JpegEntropy.h"
+
+namespace {
+
+// Number of bits of |value| (0 for 0). Quantized coefficients of 8-bit samples, and differences of
+// two DCs, stay below 2^15, so categories fit the 4 bits of a symbol
+inline int sizeCategory(int32_t value) {
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+#if defined(__GNUC__) || defined(__clang__)
+    return magnitude ? 32 - __builtin_clz(magnitude) : 0;
+#else
+    int size = 0;
+    while (magnitude) {
+        size++;
+        magnitude >>= 1;
+    }
+    return size;
+#endif
+}
+
+// Amplitude bits of a value of the given category
+inline uint32_t amplitudeBits(int32_t value, int size) {
+    return (uint32_t)(value < 0 ? value - 1 : value) & ((1u << size) - 1);
+}
+
+// Value of size amplitude bits
+inline int32_t amplitudeValue(uint32_t bits, int size) {
+    return bits < (1u << (size - 1)) ? (int32_t)bits - (int32_t)(1u << size) + 1 : (int32_t)bits;
+}
+
+// visitSymbols()
+// Description: Walks the symbols coding MCU rows [rowBegin, rowEnd), calling dc(slot, symbol,
+//              amplitude, size) and ac(slot, symbol, amplitude, size) for each
+template <typename DcVisitor, typename AcVisitor>
+void visitSymbols(const BlockPlanes &blocks, int rowBegin, int rowEnd, const int tableSlot[3], DcVisitor dc, AcVisitor ac) {
+    coefficient previousDc[3] = {0, 0, 0};
+
+    forEachMcuBlock(blocks, rowBegin, rowEnd, [&](int k, const coefficient *block) {
+        const int slot = tableSlot[k];
+
+        const int32_t difference = block[0] - previousDc[k];
+        previousDc[k] = block[0];
+        const int dcSize = sizeCategory(difference);
+        dc(slot, dcSize, amplitudeBits(difference, dcSize), dcSize);
+
+        int run = 0;
+        for (int z = 1; z < 64; z++) {
+            const coefficient value = block[zigzagIndex[z]];
+            if (value == 0) {
+                run++;
+                continue;
+            }
+
+            while (run >= 16) {
+                ac(slot, 0xF0, 0u, 0);
+                run -= 16;
+            }
+
+            const int size = sizeCategory(value);
+            ac(slot, (run << 4) | size, amplitudeBits(value, size), size);
+            run = 0;
+        }
+
+        if (run > 0) {
+            ac(slot, 0x00, 0u, 0);
+        }
+        return true;
+    });
+}
+
+// Reads size amplitude bits, false if the data ends first
+inline bool readAmplitude(BitReader &reader, int size, int32_t &value) {
+    if (size == 0) {
+        value = 0;
+        return true;
+    }
+    if (reader.bitsLeft() < (uint64_t)size) return false;
+
+    value = amplitudeValue(reader.peek(size), size);
+    reader.skip(size);
+    return true;
+}
+
+}
+
+void countRunSizeSymbols(const BlockPlanes &blocks, int rowBegin, int rowEnd, const int tableSlot[3], RunSizeFrequencies &frequencies) {
+    visitSymbols(blocks, rowBegin, rowEnd, tableSlot,
+        [&](int slot, int symbol, uint32_t, int size) {
+            frequencies.dc[slot][symbol]++;
+            frequencies.amplitudeBits += size;
+        },
+        [&](int slot, int symbol, uint32_t, int size) {
+            frequencies.ac[slot][symbol]++;
+            frequencies.amplitudeBits += size;
+        });
+}
+
+void addRunSizeFrequencies(RunSizeFrequencies &total, const RunSizeFrequencies &part) {
+    for (int slot = 0; slot < RUN_SIZE_TABLE_SLOTS; slot++) {
+        for (int symbol = 0; symbol < RUN_SIZE_DC_SYMBOLS; symbol++) total.dc[slot][symbol] += part.dc[slot][symbol];
+        for (int symbol = 0; symbol < RUN_SIZE_AC_SYMBOLS; symbol++) total.ac[slot][symbol] += part.ac[slot][symbol];
+    }
+    total.amplitudeBits += part.amplitudeBits;
+}
+
+void encodeRunSizeBlocks(const BlockPlanes &blocks, int rowBegin, int rowEnd, const int tableSlot[3], const RunSizeCodes &codes, BitWriter &writer) {
+    visitSymbols(blocks, rowBegin, rowEnd, tableSlot,
+        [&](int slot, int symbol, uint32_t amplitude, int size) {
+            writer.writeCode(codes.dc[slot][symbol]);
+            writer.write(amplitude, size);
+        },
+        [&](int slot, int symbol, uint32_t amplitude, int size) {
+            writer.writeCode(codes.ac[slot][symbol]);
+            writer.write(amplitude, size);
+        });
+}
+
+bool decodeRunSizeBlock(BitReader &reader, const HuffmanDecodeTable &dcTable, const HuffmanDecodeTable &acTable, coefficient &previousDc, coefficient *block) {
+    int symbol;
+    int32_t value;
+
+    if (!decodeHuffmanSymbol(reader, dcTable, symbol) || symbol >= RUN_SIZE_DC_SYMBOLS ||
+        !readAmplitude(reader, symbol, value)) {
+        return false;
+    }
+    previousDc += value;
+    block[0] = previousDc;
+
+    // A block ends after position 63 or at an end of block symbol
+    for (int z = 1; z < 64;) {
+        if (!decodeHuffmanSymbol(reader, acTable, symbol)) return false;
+
+        const int run = symbol >> 4;
+        const int size = symbol & 15;
+        if (size == 0) {
+            if (run == 0) break;
+            if (run != 15) return false;
+            z += 16;
+            continue;
+        }
+
+        z += run;
+        if (z > 63 || !readAmplitude(reader, size, value)) return false;
+        block[zigzagIndex[z++]] = value;
+    }
+
+    return true;
+}
+
+bool decodeRunSizeBlocks(BitReader &reader, const RunSizeDecodeTables &tables, const int tableSlot[3], BlockPlanes &blocks, int rowBegin, int rowEnd) {
+    coefficient previousDc[3] = {0, 0, 0};
+
+    return forEachMcuBlock(blocks, rowBegin, rowEnd, [&](int k, coefficient *block) {
+        return decodeRunSizeBlock(reader, tables.dc[tableSlot[k]], tables.ac[tableSlot[k]], previousDc[k], block);
+    });
+}
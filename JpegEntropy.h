@@ -0,0 +1,151 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include "JpegDct.h"
+#include "JpegHuffman.h"
+
+// (run, size) block coding
+// Baseline-JPEG-style entropy coding of quantized blocks. MCUs are coded in raster order, each as
+// its luma blocks followed by its Cb and Cr blocks, coefficients in zigzag order:
+// - DC: the difference to the previous DC of the same channel as a size category symbol (0-15)
+//   followed by that many amplitude bits
+// - AC: (zero run << 4 | size category) symbols followed by the amplitude bits, 0xF0 for a run of
+//   16 zeros and 0x00 (end of block) after the last nonzero coefficient
+// Amplitudes are stored as in JPEG: positive values as is, negative ones as value - 1 in size bits.
+// Every function works on a range of MCU rows with the DC prediction starting over, so a range
+// can be coded on its own (restart segments).
+
+// Number of Huffman table slots per kind (DC/AC) - channels map onto slots via a table index
+static const int RUN_SIZE_TABLE_SLOTS = 2;
+
+// Symbol alphabets
+static const int RUN_SIZE_DC_SYMBOLS = 16;
+static const int RUN_SIZE_AC_SYMBOLS = 256;
+
+// BlockPlanes
+// Coefficient planes the coder reads or writes: blocks of 64 coefficients (row-major) per channel,
+// block (row, col) at (row * planeCols(k) + col) * 64. Luma has rows x cols blocks; an MCU covers
+// hSampling x vSampling of them and one block of each chroma plane
+typedef struct BlockPlanes {
+    coefficient *plane[3];
+    int rows;
+    int cols;
+    int hSampling;
+    int vSampling;
+
+    int planeRows(int k) const { return k == 0 ? rows : (rows + vSampling - 1) / vSampling; }
+    int planeCols(int k) const { return k == 0 ? cols : (cols + hSampling - 1) / hSampling; }
+    int mcuRows() const { return planeRows(1); }
+} BlockPlanes;
+
+// forEachMcuPosition()
+// Description: Visits the block positions of MCU rows [mcuRowBegin, mcuRowEnd) in coding order: per
+//              MCU the luma blocks it covers in raster order, then its Cb and Cr blocks. Without
+//              subsampling that is each block position's Y, Cb and Cr block in turn
+// Input: const BlockPlanes &blocks - layout of the planes (the plane pointers are not used)
+//        int mcuRowBegin, int mcuRowEnd - MCU rows to visit
+//        Visitor visit - bool visit(int k, int row, int col) with the block row and column within
+//                        plane k, returning false to stop
+// Output: bool - false if the visitor stopped
+template <typename Visitor>
+inline bool forEachMcuPosition(const BlockPlanes &blocks, int mcuRowBegin, int mcuRowEnd, Visitor visit) {
+    const int chromaCols = blocks.planeCols(1);
+
+    for (int m = mcuRowBegin; m < mcuRowEnd; m++) {
+        const int rowBegin = m * blocks.vSampling;
+        const int rowEnd = std::min(blocks.rows, rowBegin + blocks.vSampling);
+
+        for (int c = 0; c < chromaCols; c++) {
+            const int colBegin = c * blocks.hSampling;
+            const int colEnd = std::min(blocks.cols, colBegin + blocks.hSampling);
+
+            for (int i = rowBegin; i < rowEnd; i++) {
+                for (int j = colBegin; j < colEnd; j++) {
+                    if (!visit(0, i, j)) return false;
+                }
+            }
+            for (int k = 1; k < 3; k++) {
+                if (!visit(k, m, c)) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// forEachMcuBlock()
+// Description: Visits the blocks of MCU rows [mcuRowBegin, mcuRowEnd) in coding order
+// Input: const BlockPlanes &blocks - coefficient planes
+//        int mcuRowBegin, int mcuRowEnd - MCU rows to visit
+//        Visitor visit - bool visit(int k, coefficient *block), returning false to stop
+// Output: bool - false if the visitor stopped
+template <typename Visitor>
+inline bool forEachMcuBlock(const BlockPlanes &blocks, int mcuRowBegin, int mcuRowEnd, Visitor visit) {
+    return forEachMcuPosition(blocks, mcuRowBegin, mcuRowEnd, [&](int k, int row, int col) {
+        return visit(k, blocks.plane[k] + ((size_t)row * blocks.planeCols(k) + col) * 64);
+    });
+}
+
+// RunSizeFrequencies
+// Symbol counts per table slot, and the number of amplitude bits the symbols carry
+typedef struct RunSizeFrequencies {
+    uint32_t dc[RUN_SIZE_TABLE_SLOTS][RUN_SIZE_DC_SYMBOLS] = {};
+    uint32_t ac[RUN_SIZE_TABLE_SLOTS][RUN_SIZE_AC_SYMBOLS] = {};
+    uint64_t amplitudeBits = 0;
+} RunSizeFrequencies;
+
+// RunSizeCodes
+// Huffman codes of the slots used for encoding
+typedef struct RunSizeCodes {
+    HuffmanCodeTable dc[RUN_SIZE_TABLE_SLOTS];
+    HuffmanCodeTable ac[RUN_SIZE_TABLE_SLOTS];
+} RunSizeCodes;
+
+// RunSizeDecodeTables
+// Huffman lookup tables of the slots used for decoding
+typedef struct RunSizeDecodeTables {
+    HuffmanDecodeTable dc[RUN_SIZE_TABLE_SLOTS];
+    HuffmanDecodeTable ac[RUN_SIZE_TABLE_SLOTS];
+} RunSizeDecodeTables;
+
+// countRunSizeSymbols()
+// Description: Counts the symbols coding MCU rows [rowBegin, rowEnd), DC prediction starting at 0
+// Input: const BlockPlanes &blocks - quantized coefficients
+//        int rowBegin, int rowEnd - MCU rows to count
+//        const int tableSlot[3] - table slot of each channel
+//        RunSizeFrequencies &frequencies - counts to add to
+// Output: No return value, modifies the frequencies
+void countRunSizeSymbols(const BlockPlanes &blocks, int rowBegin, int rowEnd, const int tableSlot[3], RunSizeFrequencies &frequencies);
+
+// addRunSizeFrequencies()
+// Description: Adds the counts of part to total
+void addRunSizeFrequencies(RunSizeFrequencies &total, const RunSizeFrequencies &part);
+
+// encodeRunSizeBlocks()
+// Description: Encodes MCU rows [rowBegin, rowEnd), DC prediction starting at 0
+// Input: const BlockPlanes &blocks - quantized coefficients
+//        int rowBegin, int rowEnd - MCU rows to encode
+//        const int tableSlot[3] - table slot of each channel
+//        const RunSizeCodes &codes - Huffman codes covering every symbol counted for these rows
+//        BitWriter &writer - destination of the bits
+// Output: No return value, writes to the writer
+void encodeRunSizeBlocks(const BlockPlanes &blocks, int rowBegin, int rowEnd, const int tableSlot[3], const RunSizeCodes &codes, BitWriter &writer);
+
+// decodeRunSizeBlock()
+// Description: Decodes the symbols of the next block
+// Input: BitReader &reader - source of the bits
+//        const HuffmanDecodeTable &dcTable, const HuffmanDecodeTable &acTable - tables of the channel
+//        coefficient &previousDc - DC prediction of the channel, updated to the block's DC
+//        coefficient *block - zeroed block receiving the coefficients (row-major)
+// Output: bool - false if the data ends early or is corrupt
+bool decodeRunSizeBlock(BitReader &reader, const HuffmanDecodeTable &dcTable, const HuffmanDecodeTable &acTable, coefficient &previousDc, coefficient *block);
+
+// decodeRunSizeBlocks()
+// Description: Decodes MCU rows [rowBegin, rowEnd) into zeroed planes, DC prediction starting at 0
+// Input: BitReader &reader - source of the bits
+//        const RunSizeDecodeTables &tables - lookup tables of the slots
+//        const int tableSlot[3] - table slot of each channel
+//        BlockPlanes &blocks - planes receiving the coefficients (must be zeroed)
+//        int rowBegin, int rowEnd - MCU rows to decode
+// Output: bool - false if the data ends early or is corrupt
+bool decodeRunSizeBlocks(BitReader &reader, const RunSizeDecodeTables &tables, const int tableSlot[3], BlockPlanes &blocks, int rowBegin, int rowEnd);
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include "JpegHuffman.h"
+
+using namespace std;
+
+namespace {
+
+// Code still to be resolved below the current table level (the bits already used are dropped)
+typedef struct PendingCode {
+    uint64_t code;
+    int length;
+    int symbol;
+} PendingCode;
+
+// buildLevel()
+// Description: Appends a table indexed by tableBits bits resolving the given codes, recursing into
+//              subtables for codes longer than tableBits
+// Output: int - offset of the table in table.entries
+int buildLevel(const vector<PendingCode> &codes, int tableBits, HuffmanDecodeTable &table) {
+    const int offset = (int)table.entries.size();
+    table.entries.resize(offset + ((size_t)1 << tableBits), HuffmanDecodeEntry{0, 0, 0});
+
+    // Codes that fit fill every entry starting with them, longer ones are grouped by their prefix
+    vector<vector<PendingCode>> longer((size_t)1 << tableBits);
+    for (const PendingCode &pending : codes) {
+        if (pending.length <= tableBits) {
+            const int shift = tableBits - pending.length;
+            const size_t first = (size_t)pending.code << shift;
+            for (size_t i = 0; i < ((size_t)1 << shift); i++) {
+                table.entries[offset + first + i] = HuffmanDecodeEntry{pending.symbol, (uint8_t)pending.length, 0};
+            }
+        } else {
+            const int rest = pending.length - tableBits;
+            longer[pending.code >> rest].push_back(PendingCode{pending.code & ((uint64_t(1) << rest) - 1), rest, pending.symbol});
+        }
+    }
+
+    for (size_t prefix = 0; prefix < longer.size(); prefix++) {
+        if (longer[prefix].empty()) continue;
+
+        int maxLength = 0;
+        for (const PendingCode &pending : longer[prefix]) {
+            maxLength = max(maxLength, pending.length);
+        }
+
+        const int subtableBits = min(maxLength, HuffmanDecodeTable::maxSubtableBits);
+        const int subtable = buildLevel(longer[prefix], subtableBits, table);
+        table.entries[offset + prefix] = HuffmanDecodeEntry{subtable, (uint8_t)tableBits, (uint8_t)subtableBits};
+    }
+
+    return offset;
+}
+
+// assignCanonicalCodes()
+// Description: Hands out the canonical codes of code lengths sorted by length
+// Output: bool - false if the lengths are unsorted, out of range or over-subscribed
+bool assignCanonicalCodes(const vector<HuffmanCodeLength> &lengths, vector<PendingCode> &codes) {
+    uint64_t code = 0;
+    int length = 0;
+
+    for (const HuffmanCodeLength &entry : lengths) {
+        if (entry.length < max(length, 1) || entry.length > 63) return false;
+
+        code <<= entry.length - length;
+        length = entry.length;
+        if (code >> length) return false;
+
+        codes.push_back(PendingCode{code, length, entry.symbol});
+        code++;
+    }
+
+    return true;
+}
+
+// buildDecodeLevels()
+// Description: Builds the lookup tables of a list of codes
+void buildDecodeLevels(const vector<PendingCode> &codes, HuffmanDecodeTable &table) {
+    table.primaryBits = 0;
+    table.entries.clear();
+    if (codes.empty()) return;
+
+    int maxLength = 0;
+    for (const PendingCode &pending : codes) {
+        maxLength = max(maxLength, pending.length);
+    }
+
+    table.primaryBits = min(maxLength, HuffmanDecodeTable::maxPrimaryBits);
+    buildLevel(codes, table.primaryBits, table);
+}
+
+}
+
+vector<HuffmanCodeLength> buildHuffmanCodeLengths(const map<int, int> &frequencies, int maxLength) {
+    vector<HuffmanCodeLength> lengths;
+    const int count = (int)frequencies.size();
+    if (count == 0) return lengths;
+
+    // Raising the limit for alphabets too large to fit in it
+    while (maxLength < 62 && ((uint64_t)1 << maxLength) < (uint64_t)count) {
+        maxLength++;
+    }
+
+    // Symbols by decreasing frequency (then increasing value), the order shorter codes go in
+    vector<pair<int, int>> symbols(frequencies.begin(), frequencies.end());
+    stable_sort(symbols.begin(), symbols.end(), [](const pair<int, int> &a, const pair<int, int> &b) {
+        return a.second > b.second;
+    });
+
+    // Building the Huffman tree over node indices (leaves first), ties going to the older node
+    vector<int> bits(max(count, 2) + 1, 0);
+    if (count == 1) {
+        bits[1] = 1;
+    } else {
+        vector<int> parent(2 * count - 1, -1);
+        typedef pair<uint64_t, int> Weighted;
+        priority_queue<Weighted, vector<Weighted>, greater<Weighted>> queue;
+        for (int i = 0; i < count; i++) {
+            queue.push(Weighted((uint64_t)(unsigned)symbols[i].second, i));
+        }
+
+        int next = count;
+        while (queue.size() > 1) {
+            const Weighted a = queue.top();
+            queue.pop();
+            const Weighted b = queue.top();
+            queue.pop();
+
+            parent[a.second] = next;
+            parent[b.second] = next;
+            queue.push(Weighted(a.first + b.first, next++));
+        }
+
+        // Counting the leaves at each depth
+        for (int i = 0; i < count; i++) {
+            int depth = 0;
+            for (int node = i; parent[node] != -1; node = parent[node]) depth++;
+            if (depth >= (int)bits.size()) bits.resize(depth + 1, 0);
+            bits[depth]++;
+        }
+    }
+
+    // Moving leaves deeper than maxLength up: a pair of overlong leaves is replaced by one leaf a level
+    // up, and the other joins a shorter leaf that moves one level down
+    if ((int)bits.size() <= maxLength) bits.resize(maxLength + 1, 0);
+    for (int i = (int)bits.size() - 1; i > maxLength; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) j--;
+
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    // Handing out the lengths, shortest to the most frequent symbols
+    int symbol = 0;
+    for (int length = 1; length <= maxLength; length++) {
+        for (int k = 0; k < bits[length]; k++) {
+            lengths.push_back(HuffmanCodeLength{symbols[symbol++].first, length});
+        }
+    }
+
+    sort(lengths.begin(), lengths.end(), [](const HuffmanCodeLength &a, const HuffmanCodeLength &b) {
+        return a.length != b.length ? a.length < b.length : a.symbol < b.symbol;
+    });
+
+    return lengths;
+}
+
+bool buildCanonicalHuffmanCodes(const vector<HuffmanCodeLength> &lengths, HuffmanCodeTable &codes) {
+    codes.minSymbol = 0;
+    codes.codes.clear();
+
+    vector<PendingCode> canonical;
+    if (!assignCanonicalCodes(lengths, canonical)) return false;
+    if (canonical.empty()) return true;
+
+    int minSymbol = canonical[0].symbol, maxSymbol = canonical[0].symbol;
+    for (const PendingCode &pending : canonical) {
+        minSymbol = min(minSymbol, pending.symbol);
+        maxSymbol = max(maxSymbol, pending.symbol);
+    }
+
+    codes.minSymbol = minSymbol;
+    codes.codes.assign((size_t)maxSymbol - minSymbol + 1, HuffmanCode{0, 0});
+    for (const PendingCode &pending : canonical) {
+        codes.codes[pending.symbol - minSymbol] = HuffmanCode{pending.code, pending.length};
+    }
+
+    return true;
+}
+
+bool buildHuffmanDecodeTable(const vector<pair<int, HuffmanCode>> &codes, HuffmanDecodeTable &table) {
+    vector<PendingCode> pending;
+    pending.reserve(codes.size());
+
+    for (const auto &entry : codes) {
+        if (entry.second.length < 1 || entry.second.length > 63) {
+            buildDecodeLevels({}, table);
+            return false;
+        }
+        pending.push_back(PendingCode{entry.second.code, entry.second.length, entry.first});
+    }
+
+    buildDecodeLevels(pending, table);
+    return true;
+}
+
+bool buildHuffmanDecodeTable(const vector<HuffmanCodeLength> &lengths, HuffmanDecodeTable &table) {
+    vector<PendingCode> pending;
+    pending.reserve(lengths.size());
+
+    if (!assignCanonicalCodes(lengths, pending)) {
+        buildDecodeLevels({}, table);
+        return false;
+    }
+
+    buildDecodeLevels(pending, table);
+    return true;
+}
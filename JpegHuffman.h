@@ -0,0 +1,222 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+// HuffmanCode
+// Huffman code of one symbol, right-aligned: the first bit of the code is bit (length - 1). Codes
+// come from a tree walk that rejects codes longer than 63 bits
+typedef struct HuffmanCode {
+    uint64_t code;
+    int length;
+} HuffmanCode;
+
+// HuffmanCodeTable
+// Flat code table covering the symbols minSymbol..minSymbol + codes.size() - 1, indexed directly
+// by symbol instead of looking codes up in a map
+typedef struct HuffmanCodeTable {
+    int minSymbol = 0;
+    std::vector<HuffmanCode> codes;
+
+    const HuffmanCode& operator[](int symbol) const { return codes[symbol - minSymbol]; }
+} HuffmanCodeTable;
+
+// HuffmanCodeLength
+// Code length of one symbol. A list of them sorted by (length, symbol) defines a canonical code:
+// codes are handed out in that order, counting up and appending a zero bit whenever the length grows
+typedef struct HuffmanCodeLength {
+    int symbol;
+    int length;
+} HuffmanCodeLength;
+
+// Longest code buildHuffmanCodeLengths() produces for alphabets of up to 2^16 symbols
+static const int HUFFMAN_MAX_CODE_LENGTH = 16;
+
+// buildHuffmanCodeLengths()
+// Description: Computes Huffman code lengths limited to maxLength bits (raised to fit alphabets of
+//              more than 2^maxLength symbols). Overlong codes are shortened as in JPEG Annex K.3;
+//              a single symbol gets a 1 bit code
+// Input: const map<int, int> &frequencies - map of value to frequency
+//        int maxLength - longest code allowed
+// Output: vector<HuffmanCodeLength> - code lengths sorted by (length, symbol)
+std::vector<HuffmanCodeLength> buildHuffmanCodeLengths(const std::map<int, int> &frequencies, int maxLength);
+
+// buildCanonicalHuffmanCodes()
+// Description: Assigns the canonical codes of a list of code lengths
+// Input: const vector<HuffmanCodeLength> &lengths - code lengths sorted by length
+//        HuffmanCodeTable &codes - table to fill
+// Output: bool - false if the lengths do not form a valid prefix code
+bool buildCanonicalHuffmanCodes(const std::vector<HuffmanCodeLength> &lengths, HuffmanCodeTable &codes);
+
+// BitWriter
+// Packs bits most significant first into a byte buffer. Bits collect in a 64-bit accumulator and
+// go to the buffer four bytes at a time, so a code costs a shift, an or and (sometimes) a flush
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char> &output) : output(output) {}
+
+    // write()
+    // Description: Appends the low length bits of bits (length <= 32, higher bits must be zero)
+    void write(uint32_t bits, int length) {
+        accumulator = (accumulator << length) | bits;
+        pending += length;
+        written += length;
+
+        if (pending >= 32) {
+            pending -= 32;
+            const uint32_t word = (uint32_t)(accumulator >> pending);
+            output.push_back((unsigned char)(word >> 24));
+            output.push_back((unsigned char)(word >> 16));
+            output.push_back((unsigned char)(word >> 8));
+            output.push_back((unsigned char)word);
+        }
+    }
+
+    // writeCode()
+    // Description: Appends a Huffman code
+    void writeCode(const HuffmanCode &code) {
+        if (code.length > 32) {
+            write((uint32_t)(code.code >> 32), code.length - 32);
+            write((uint32_t)code.code, 32);
+        } else {
+            write((uint32_t)code.code, code.length);
+        }
+    }
+
+    // flush()
+    // Description: Writes out the pending bits, padding the last byte with zero bits
+    void flush() {
+        while (pending >= 8) {
+            pending -= 8;
+            output.push_back((unsigned char)(accumulator >> pending));
+        }
+        if (pending > 0) {
+            output.push_back((unsigned char)(accumulator << (8 - pending)));
+            pending = 0;
+        }
+    }
+
+    // Number of bits written so far (without the padding added by flush())
+    uint64_t bitCount() const { return written; }
+
+private:
+    std::vector<unsigned char> &output;
+    uint64_t accumulator = 0;
+    int pending = 0;
+    uint64_t written = 0;
+};
+
+// BitReader
+// Reads bits most significant first from a byte span. The next bits are kept left-aligned in a
+// 64-bit buffer that is refilled a byte at a time; reading past the end yields zero bits
+class BitReader {
+public:
+    BitReader(const unsigned char *data, size_t size) : data(data), size(size), bitCount((uint64_t)size * 8) {}
+
+    // Reader of the first bitCount bits of the span (bitCount <= size * 8)
+    BitReader(const unsigned char *data, size_t size, uint64_t bitCount) : data(data), size(size), bitCount(bitCount) {}
+
+    // peek()
+    // Description: Returns the next length bits (1 <= length <= 32) without consuming them
+    uint32_t peek(int length) {
+        if (buffered < length) refill();
+        return (uint32_t)(buffer >> (64 - length));
+    }
+
+    // skip()
+    // Description: Consumes length bits (at most the number of bits last peeked)
+    void skip(int length) {
+        buffer <<= length;
+        buffered -= length;
+        consumed += length;
+    }
+
+    // Number of bits consumed so far and number of bits left in the span
+    uint64_t position() const { return consumed; }
+    uint64_t bitsLeft() const { return bitCount - consumed; }
+
+private:
+    void refill() {
+        while (buffered <= 56) {
+            const uint64_t byte = next < size ? data[next] : 0;
+            buffer |= byte << (56 - buffered);
+            buffered += 8;
+            next++;
+        }
+    }
+
+    const unsigned char *data;
+    size_t size;
+    uint64_t bitCount;
+    size_t next = 0;
+    uint64_t buffer = 0;
+    int buffered = 0;
+    uint64_t consumed = 0;
+};
+
+// HuffmanDecodeEntry
+// One lookup table entry. A leaf holds the decoded symbol and the number of bits its code uses at
+// this level; a link (subtableBits > 0) consumes length bits and continues in the subtable at
+// offset value, indexed by the next subtableBits bits. length 0 marks a bit pattern no code uses
+typedef struct HuffmanDecodeEntry {
+    int32_t value;
+    uint8_t length;
+    uint8_t subtableBits;
+} HuffmanDecodeEntry;
+
+// HuffmanDecodeTable
+// Multi-level lookup tables: a primary table indexed by the next primaryBits bits resolves every
+// code of up to primaryBits bits in one lookup, longer codes continue in subtables of up to
+// subtableBits bits each. All tables share one flat vector
+typedef struct HuffmanDecodeTable {
+    static constexpr int maxPrimaryBits = 10;
+    static constexpr int maxSubtableBits = 6;
+
+    int primaryBits = 0;
+    std::vector<HuffmanDecodeEntry> entries;
+} HuffmanDecodeTable;
+
+// buildHuffmanDecodeTable()
+// Description: Builds the lookup tables decoding a list of (symbol, code) pairs, without a table
+//              spanning the range of the symbols (they may come from an untrusted file)
+// Input: const vector<pair<int, HuffmanCode>> &codes - prefix-free codes to decode
+//        HuffmanDecodeTable &table - table to fill
+// Output: bool - false if a code is empty or longer than 63 bits (the table is left empty)
+bool buildHuffmanDecodeTable(const std::vector<std::pair<int, HuffmanCode>> &codes, HuffmanDecodeTable &table);
+
+// buildHuffmanDecodeTable()
+// Description: Builds the lookup tables decoding a canonical code straight from its code lengths
+// Input: const vector<HuffmanCodeLength> &lengths - code lengths sorted by length
+//        HuffmanDecodeTable &table - table to fill
+// Output: bool - false if the lengths do not form a valid prefix code
+bool buildHuffmanDecodeTable(const std::vector<HuffmanCodeLength> &lengths, HuffmanDecodeTable &table);
+
+// decodeHuffmanSymbol()
+// Description: Decodes the next symbol. A code running past the end of the span is not decoded
+//              (the reader may be left partway into it)
+// Input: BitReader &reader - bit source
+//        const HuffmanDecodeTable &table - lookup tables of the codes
+//        int &symbol - receives the decoded symbol
+// Output: bool - false at the end of the data (or on a bit pattern no code uses)
+inline bool decodeHuffmanSymbol(BitReader &reader, const HuffmanDecodeTable &table, int &symbol) {
+    if (table.primaryBits == 0) return false;
+
+    const uint64_t bitsLeft = reader.bitsLeft();
+    uint64_t used = 0;
+    const HuffmanDecodeEntry *entry = &table.entries[reader.peek(table.primaryBits)];
+
+    while (entry->subtableBits > 0) {
+        used += entry->length;
+        if (used > bitsLeft) return false;
+        reader.skip(entry->length);
+        entry = &table.entries[entry->value + reader.peek(entry->subtableBits)];
+    }
+
+    if (entry->length == 0 || used + entry->length > bitsLeft) return false;
+
+    reader.skip(entry->length);
+    symbol = entry->value;
+    return true;
+}
@@ -0,0 +1,264 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <png.h>
+#include "PngCodec.h"
+
+using namespace std;
+
+namespace {
+
+// Source of a PNG decoded from memory
+typedef struct MemorySource {
+    const unsigned char *data;
+    size_t size;
+    size_t offset;
+} MemorySource;
+
+void readFromMemory(png_structp png, png_bytep output, png_size_t length) {
+    MemorySource *source = static_cast<MemorySource*>(png_get_io_ptr(png));
+    if (length > source->size - source->offset) {
+        png_error(png, "PNG data ends early");
+    }
+    memcpy(output, source->data + source->offset, length);
+    source->offset += length;
+}
+
+void writeToMemory(png_structp png, png_bytep data, png_size_t length) {
+    vector<unsigned char> *output = static_cast<vector<unsigned char>*>(png_get_io_ptr(png));
+    output->insert(output->end(), data, data + length);
+}
+
+void flushMemory(png_structp) {}
+
+// Errors are reported through the return values, warnings are not reported at all
+void reportError(png_structp png, png_const_charp message) {
+    cout << "Invalid PNG (" << message << ") - PngCodec" << endl;
+    png_longjmp(png, 1);
+}
+
+void ignoreWarning(png_structp, png_const_charp) {}
+
+// expandToRgb()
+// Description: Sets up the transforms reading any image as 8-bit RGB rows (and the passes of
+//              interlaced images), once the info is read. Runs under the caller's setjmp
+void expandToRgb(png_structp png, png_infop info) {
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    png_set_gray_to_rgb(png);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    if (png_get_rowbytes(png, info) != (size_t)png_get_image_width(png, info) * sizeof(color)) {
+        png_error(png, "unexpected row size");
+    }
+}
+
+// readPixels()
+// Description: Reads the whole image straight into the rows of pixels, once the transforms are set
+//              up. Runs under the caller's setjmp
+void readPixels(png_structp png, png_infop info, PixelBuffer<color> &pixels, vector<png_bytep> &rows) {
+    const png_uint_32 width = png_get_image_width(png, info);
+    const png_uint_32 height = png_get_image_height(png, info);
+
+    pixels.allocate((int)width, (int)height);
+    rows.resize(height);
+    for (png_uint_32 y = 0; y < height; y++) {
+        rows[y] = reinterpret_cast<png_bytep>(pixels[(int)y]);
+    }
+
+    png_read_image(png, rows.data());
+    png_read_end(png, nullptr);
+}
+
+// readImage()
+// Description: Reads an image whose source is set up into pixels. The buffers live in the caller
+//              so that nothing set up here is left to a longjmp out of libpng
+bool readImage(png_structp png, png_infop info, PixelBuffer<color> &pixels, vector<png_bytep> &rows) {
+    if (setjmp(png_jmpbuf(png))) {
+        return false;
+    }
+
+    png_read_info(png, info);
+    expandToRgb(png, info);
+    readPixels(png, info, pixels, rows);
+    return true;
+}
+
+// streamImage()
+// Description: Reads an image whose source is set up one row at a time into row, handing each to
+//              visit. Interlaced images are read whole into pixels first (their rows are only
+//              complete after the last pass)
+bool streamImage(png_structp png, png_infop info, const function<bool(const color*, int)> &visit, vector<color> &row,
+                 PixelBuffer<color> &pixels, vector<png_bytep> &rows) {
+    if (setjmp(png_jmpbuf(png))) {
+        return false;
+    }
+
+    png_read_info(png, info);
+    expandToRgb(png, info);
+
+    if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+        readPixels(png, info, pixels, rows);
+        for (int y = 0; y < pixels.height(); y++) {
+            if (!visit(pixels[y], pixels.width())) break;
+        }
+        return true;
+    }
+
+    const png_uint_32 width = png_get_image_width(png, info);
+    const png_uint_32 height = png_get_image_height(png, info);
+    row.resize(width);
+    for (png_uint_32 y = 0; y < height; y++) {
+        png_read_row(png, reinterpret_cast<png_bytep>(row.data()), nullptr);
+        if (!visit(row.data(), (int)width)) break;
+    }
+    return true;
+}
+
+// writeImage()
+// Description: Writes pixels as an 8-bit RGB image to a destination that is set up
+bool writeImage(png_structp png, png_infop info, const PixelBuffer<color> &pixels, vector<png_bytep> &rows) {
+    if (setjmp(png_jmpbuf(png))) {
+        return false;
+    }
+
+    png_set_IHDR(png, info, pixels.width(), pixels.height(), 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    rows.resize(pixels.height());
+    for (int y = 0; y < pixels.height(); y++) {
+        rows[y] = reinterpret_cast<png_bytep>(const_cast<color*>(pixels[y]));
+    }
+
+    png_write_info(png, info);
+    png_write_image(png, rows.data());
+    png_write_end(png, nullptr);
+    return true;
+}
+
+// read()
+// Description: Runs read(png, info) on a read structure whose source setSource() installs
+template <typename Setup, typename Read>
+bool read(Setup setSource, Read readImage) {
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, reportError, ignoreWarning);
+    if (!png) return false;
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        return false;
+    }
+
+    setSource(png);
+    const bool valid = readImage(png, info);
+    png_destroy_read_struct(&png, &info, nullptr);
+    return valid;
+}
+
+// decode()
+// Description: Decodes a whole image from the source setSource() installs
+template <typename Setup>
+bool decode(PixelBuffer<color> &pixels, Setup setSource) {
+    vector<png_bytep> rows;
+    const bool decoded = read(setSource, [&](png_structp png, png_infop info) { return readImage(png, info, pixels, rows); });
+
+    if (!decoded) {
+        pixels.release();
+    }
+    return decoded;
+}
+
+// stream()
+// Description: Streams the rows of an image from the source setSource() installs
+template <typename Setup>
+bool stream(const function<bool(const color*, int)> &visit, Setup setSource) {
+    vector<color> row;
+    PixelBuffer<color> pixels;
+    vector<png_bytep> rows;
+    return read(setSource, [&](png_structp png, png_infop info) { return streamImage(png, info, visit, row, pixels, rows); });
+}
+
+// encode()
+// Description: Encodes to the destination setDestination() installs on the write structure
+template <typename Setup>
+bool encode(const PixelBuffer<color> &pixels, Setup setDestination) {
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, reportError, ignoreWarning);
+    if (!png) return false;
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_write_struct(&png, nullptr);
+        return false;
+    }
+
+    setDestination(png);
+    vector<png_bytep> rows;
+    const bool encoded = writeImage(png, info, pixels, rows);
+    png_destroy_write_struct(&png, &info);
+    return encoded;
+}
+
+}
+
+bool isPngData(const unsigned char *data, size_t size) {
+    return size >= 8 && png_sig_cmp(const_cast<png_bytep>(data), 0, 8) == 0;
+}
+
+bool decodePng(const unsigned char *data, size_t size, PixelBuffer<color> &pixels) {
+    if (!isPngData(data, size)) {
+        return false;
+    }
+
+    MemorySource source = { data, size, 0 };
+    return decode(pixels, [&source](png_structp png) { png_set_read_fn(png, &source, readFromMemory); });
+}
+
+// withPngFile()
+// Description: Opens a file, checks its PNG signature and runs read(setSource) with a source
+//              reading the rest of the file
+template <typename Read>
+bool withPngFile(const string &path, Read read) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    unsigned char signature[8];
+    bool valid = false;
+    if (fread(signature, 1, sizeof(signature), file) == sizeof(signature) && isPngData(signature, sizeof(signature))) {
+        valid = read([file](png_structp png) {
+            png_init_io(png, file);
+            png_set_sig_bytes(png, 8);
+        });
+    }
+
+    fclose(file);
+    return valid;
+}
+
+bool readPngFile(const string &path, PixelBuffer<color> &pixels) {
+    return withPngFile(path, [&pixels](auto setSource) { return decode(pixels, setSource); });
+}
+
+bool streamPng(const unsigned char *data, size_t size, const function<bool(const color*, int)> &visit) {
+    if (!isPngData(data, size)) {
+        return false;
+    }
+
+    MemorySource source = { data, size, 0 };
+    return stream(visit, [&source](png_structp png) { png_set_read_fn(png, &source, readFromMemory); });
+}
+
+bool streamPngFile(const string &path, const function<bool(const color*, int)> &visit) {
+    return withPngFile(path, [&visit](auto setSource) { return stream(visit, setSource); });
+}
+
+bool encodePng(const PixelBuffer<color> &pixels, vector<unsigned char> &output) {
+    return encode(pixels, [&output](png_structp png) { png_set_write_fn(png, &output, writeToMemory, flushMemory); });
+}
+
+bool writePngFile(const string &path, const PixelBuffer<color> &pixels) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    const bool encoded = encode(pixels, [file](png_structp png) { png_init_io(png, file); });
+    return fclose(file) == 0 && encoded;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "StegoLib.h"
+
+// In-process PNG decoding and encoding through libpng, straight from and into the rows of a
+// PixelBuffer. Images of any PNG colour type and bit depth are read as 8-bit RGB (alpha is
+// dropped, grayscale expanded, 16-bit samples reduced to their high byte); images are written as
+// 8-bit RGB
+
+// decodePng()
+// Description: Decodes a PNG image held in memory
+// Input: const unsigned char *data, size_t size - bytes of the PNG file
+//        PixelBuffer<color> &pixels - receives the image (allocated here)
+// Output: bool - false if the data is not a valid PNG image
+bool decodePng(const unsigned char *data, size_t size, PixelBuffer<color> &pixels);
+
+// readPngFile()
+// Description: Decodes a PNG file, streaming it from disk
+// Input: const string &path - path to the PNG file
+//        PixelBuffer<color> &pixels - receives the image (allocated here)
+// Output: bool - false if the file cannot be read or is not a valid PNG image
+bool readPngFile(const std::string &path, PixelBuffer<color> &pixels);
+
+// streamPng()
+// Description: Decodes a PNG image held in memory one row at a time, handing each row (as 8-bit RGB)
+//              to visit(row, width) until it returns false; decompression stops there. Only one row
+//              is held in memory, except for interlaced images, which are decoded whole first
+// Input: const unsigned char *data, size_t size - bytes of the PNG file
+//        visit - called with each row in order, returns false to stop
+// Output: bool - false if the data is not a valid PNG image (up to the rows read)
+bool streamPng(const unsigned char *data, size_t size, const std::function<bool(const color*, int)> &visit);
+
+// streamPngFile()
+// Description: Decodes a PNG file one row at a time, see streamPng()
+// Output: bool - false if the file cannot be read or is not a valid PNG image (up to the rows read)
+bool streamPngFile(const std::string &path, const std::function<bool(const color*, int)> &visit);
+
+// isPngData()
+// Description: Checks for the PNG signature at the start of a buffer
+bool isPngData(const unsigned char *data, size_t size);
+
+// encodePng()
+// Description: Encodes an interleaved RGB buffer as a PNG image in memory
+// Input: const PixelBuffer<color> &pixels - image to encode
+//        vector<unsigned char> &output - buffer the PNG file is appended to
+// Output: bool - false if libpng fails
+bool encodePng(const PixelBuffer<color> &pixels, std::vector<unsigned char> &output);
+
+// writePngFile()
+// Description: Encodes an interleaved RGB buffer to a PNG file
+// Input: const string &path - path to the output file
+//        const PixelBuffer<color> &pixels - image to encode
+// Output: bool - false if the file cannot be written
+bool writePngFile(const std::string &path, const PixelBuffer<color> &pixels);
@@ -68,7 +68,7 @@ void loadJpgLSBData(vector<pair<VectorXd, VectorXd>> &data, const string &coverD
 
                         cout << "decoding" << endl;
                         if (entry.path().extension() == ".dat")
-                            image->decodeJpeg(entry.path().string());
+                            image->decodeJpeg(entry.path().string(), DecodeUntil::Coefficients);
                         else
                             image->loadPng(entry.path().string());
 
@@ -76,13 +76,14 @@ void loadJpgLSBData(vector<pair<VectorXd, VectorXd>> &data, const string &coverD
 
                         int i = 0;
 
-                        for (auto &block : image->quantizedBlocks) {
-                            for (auto &dctBlock : block) {
+                        for (int row = 0; row < image->quantizedBlocks.rows(); row++) {
+                            for (int col = 0; col < image->quantizedBlocks.cols(); col++) {
+                                DCTBlock dctBlock = image->quantizedBlocks.block(row, col);
                                 for (int l = 0; l < 8; l++) {
                                     for (int n = 0; n < 8; n++) {
-                                        input(i++) = dctBlock->Y[l][n];
-                                        input(i++) = dctBlock->Cb[l][n];
-                                        input(i++) = dctBlock->Cr[l][n];
+                                        input(i++) = dctBlock.Y[l * 8 + n];
+                                        input(i++) = dctBlock.Cb[l * 8 + n];
+                                        input(i++) = dctBlock.Cr[l * 8 + n];
                                     }
                                 }
                             }
@@ -6,6 +6,9 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstddef>
+#include <cstring>
+#include <new>
 
 using namespace std;
 using namespace cimg_library;
@@ -15,6 +18,72 @@ void messageToVector(string path, vector<unsigned char> *vec);
 bool getBit(unsigned char value, int position);
 string loadStringFromFile(string filename);
 
+// AlignedBuffer
+// Single zero-initialised heap allocation of count elements, aligned for SIMD loads (used for
+// coefficient planes and pixel data). T must be trivially copyable.
+template <typename T, size_t Alignment = 64>
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t count) { allocate(count); }
+    AlignedBuffer(const AlignedBuffer &other) { copyFrom(other); }
+    AlignedBuffer(AlignedBuffer &&other) noexcept : ptr(other.ptr), count(other.count) {
+        other.ptr = nullptr;
+        other.count = 0;
+    }
+    ~AlignedBuffer() { release(); }
+
+    AlignedBuffer& operator=(const AlignedBuffer &other) {
+        if (this != &other) copyFrom(other);
+        return *this;
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer &&other) noexcept {
+        if (this != &other) {
+            release();
+            ptr = other.ptr;
+            count = other.count;
+            other.ptr = nullptr;
+            other.count = 0;
+        }
+        return *this;
+    }
+
+    // Allocates count elements, reusing the current allocation when the size is unchanged
+    void allocate(size_t newCount) {
+        if (newCount != count) {
+            release();
+            if (newCount > 0) {
+                ptr = static_cast<T*>(::operator new(newCount * sizeof(T), std::align_val_t(Alignment)));
+            }
+            count = newCount;
+        }
+        if (ptr) memset(ptr, 0, count * sizeof(T));
+    }
+
+    void release() {
+        if (ptr) ::operator delete(ptr, std::align_val_t(Alignment));
+        ptr = nullptr;
+        count = 0;
+    }
+
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) { return ptr[i]; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+
+private:
+    void copyFrom(const AlignedBuffer &other) {
+        allocate(other.count);
+        if (count > 0) memcpy(ptr, other.ptr, count * sizeof(T));
+    }
+
+    T *ptr = nullptr;
+    size_t count = 0;
+};
+
 // Image class
 typedef struct color {
 	unsigned char r;
@@ -28,6 +97,70 @@ typedef struct ycbcr {
     unsigned char cr;
 } ycbcr;
 
+// PixelBuffer
+// width x height image of interleaved T pixels (a struct of byte channels such as color or ycbcr) in
+// a single aligned allocation. Rows start every stride() bytes, a multiple of 64 so that every row
+// is aligned for SIMD loads
+template <typename T>
+class PixelBuffer {
+public:
+    // Allocates zeroed pixels, reusing the current allocation when the size is unchanged
+    void allocate(int newWidth, int newHeight) {
+        pixelWidth = newWidth > 0 ? newWidth : 0;
+        pixelHeight = newHeight > 0 ? newHeight : 0;
+
+        rowStride = ((size_t)pixelWidth * sizeof(T) + 63) / 64 * 64;
+        bytes.allocate(rowStride * pixelHeight);
+    }
+
+    // Narrows the buffer to its top-left newWidth x newHeight pixels in place, rows keeping their stride
+    void crop(int newWidth, int newHeight) {
+        pixelWidth = max(0, min(pixelWidth, newWidth));
+        pixelHeight = max(0, min(pixelHeight, newHeight));
+    }
+
+    void release() {
+        bytes.release();
+        pixelWidth = 0;
+        pixelHeight = 0;
+        rowStride = 0;
+    }
+
+    int width() const { return pixelWidth; }
+    int height() const { return pixelHeight; }
+    size_t stride() const { return rowStride; }
+    bool empty() const { return bytes.empty(); }
+
+    // Row y, so that pixels[y][x] is pixel (x, y)
+    T* operator[](int y) { return reinterpret_cast<T*>(bytes.data() + (size_t)y * rowStride); }
+    const T* operator[](int y) const { return reinterpret_cast<const T*>(bytes.data() + (size_t)y * rowStride); }
+
+    unsigned char* data() { return bytes.data(); }
+    const unsigned char* data() const { return bytes.data(); }
+
+private:
+    AlignedBuffer<unsigned char> bytes;
+    int pixelWidth = 0;
+    int pixelHeight = 0;
+    size_t rowStride = 0;
+};
+
+// copyFromCImg()
+// Description: Copies the top-left width x height pixels of a CImg image (planar, channels past its
+//              last one repeating the last) into an interleaved RGB buffer, allocating it
+// Input: const CImg<unsigned char> &image - source image
+//        PixelBuffer<color> &pixels - destination buffer
+//        int width, int height - size to copy (at most the image's size)
+// Output: No return value, modifies the pixel buffer
+void copyFromCImg(const CImg<unsigned char> &image, PixelBuffer<color> &pixels, int width, int height);
+
+// copyToCImg()
+// Description: Copies an interleaved RGB buffer into a CImg image of the same size and 3 channels
+// Input: const PixelBuffer<color> &pixels - source buffer
+//        CImg<unsigned char> &image - destination image, resized to the buffer
+// Output: No return value, modifies the image
+void copyToCImg(const PixelBuffer<color> &pixels, CImg<unsigned char> &image);
+
 // enum definitions
 enum class encoding_status {
 	MESSAGE,
@@ -38,8 +171,9 @@ enum class encoding_status {
 class Image {
 public:
 	string path;
+	// Image as loaded, released by generateBitmap() once pixels holds it
 	CImg<unsigned char> *image;
-	vector<vector<color>> pixels;
+	PixelBuffer<color> pixels;
 	unsigned int width;
 	unsigned int height;
 
@@ -56,12 +190,23 @@ public:
 
 	void printBitmap();
 
+	// Embeds the message in place in the pixel buffer, saves the image from it and restores the rows
+	// the message covered
 	void encodeLSB(string outputFilename, string message);
 
+	// Embed a message without an Image: the PNG is decoded into a single pixel buffer, the message
+	// embedded in it and the buffer saved
+	static bool embedLSBMessage(const string &inputPath, const string &outputFilename, const string &message);
+
 	void decodeLSB(string outputFilename);
 
     string decodeLSB();
 
+	// Extract a message without loading the image: the PNG is decoded a row at a time and
+	// decompression stops at the terminator
+	static string extractLSBMessage(const string &path);
+	static string extractLSBMessageFromMemory(const unsigned char *data, size_t size);
+
 	void save_resize(const string &outputFilename, int factor);
 
     void save(const string& outputFilename);
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cstring>
+#include "StegoLsb.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define STEGO_LSB_SSE2 1
+#    include <emmintrin.h>
+#endif
+
+// Payload bit i of a byte stream, most significant bit first
+static inline unsigned char payloadBit(const unsigned char *payload, uint64_t i) {
+    return (payload[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+// spreadBits()
+// Description: Word with the bits of a payload byte in the LSBs of its 8 bytes, in memory order
+//              (the first bit in the first byte), whatever the byte order of the machine
+static uint64_t spreadBits(unsigned char value) {
+    struct Table {
+        uint64_t word[256];
+        Table() {
+            for (int v = 0; v < 256; v++) {
+                unsigned char bytes[8];
+                for (int k = 0; k < 8; k++) bytes[k] = (v >> (7 - k)) & 1;
+                memcpy(&word[v], bytes, 8);
+            }
+        }
+    };
+    static const Table table;
+    return table.word[value];
+}
+
+void embedLsbBits(unsigned char *channels, size_t count, const unsigned char *payload, uint64_t firstBit) {
+    size_t i = 0;
+
+    // Scalar head up to a payload byte boundary
+    for (; i < count && (firstBit + i) % 8 != 0; i++) {
+        channels[i] = (channels[i] & 0xFE) | payloadBit(payload, firstBit + i);
+    }
+    const unsigned char *bytes = payload + (firstBit + i) / 8;
+
+#ifdef STEGO_LSB_SSE2
+    // 16 channels per step: each of two payload bytes is broadcast over 8 lanes, and every lane keeps
+    // its own bit of it as a 0/1 byte
+    const __m128i select = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                         (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 16 <= count; i += 16, bytes += 2) {
+        const __m128i spread = _mm_set_epi64x((long long)(0x0101010101010101ull * bytes[1]), (long long)(0x0101010101010101ull * bytes[0]));
+        const __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(spread, select), select), one);
+
+        __m128i *target = reinterpret_cast<__m128i*>(channels + i);
+        _mm_storeu_si128(target, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(target), keep), bits));
+    }
+#endif
+
+    // Word-parallel: 8 channels (one payload byte) per step
+    for (; i + 8 <= count; i += 8, bytes++) {
+        uint64_t word;
+        memcpy(&word, channels + i, 8);
+        word = (word & 0xFEFEFEFEFEFEFEFEull) | spreadBits(*bytes);
+        memcpy(channels + i, &word, 8);
+    }
+
+    // Scalar tail
+    for (; i < count; i++) {
+        channels[i] = (channels[i] & 0xFE) | payloadBit(payload, firstBit + i);
+    }
+}
+
+void embedLsbPayload(PixelBuffer<color> &pixels, const unsigned char *payload, uint64_t bitCount) {
+    const size_t rowChannels = (size_t)pixels.width() * 3;
+    uint64_t bit = 0;
+
+    for (int y = 0; y < pixels.height() && bit < bitCount; y++) {
+        const size_t count = (size_t)std::min<uint64_t>(rowChannels, bitCount - bit);
+        embedLsbBits(reinterpret_cast<unsigned char*>(pixels[y]), count, payload, bit);
+        bit += count;
+    }
+}
+
+bool embedLsbMessage(PixelBuffer<color> &pixels, const std::string &message) {
+    const uint64_t bitCount = ((uint64_t)message.size() + 1) * 8;
+    if (bitCount > lsbCapacity(pixels.width(), pixels.height())) {
+        return false;
+    }
+
+    // c_str() carries the null terminator
+    embedLsbPayload(pixels, reinterpret_cast<const unsigned char*>(message.c_str()), bitCount);
+    return true;
+}
+
+#ifdef STEGO_LSB_SSE2
+// packLanes()
+// Description: LSBs of 16 channels as 2 payload bytes (low byte first). The bytes of each half are
+//              reversed first so that the first channel of a byte ends up in its top bit
+static inline int packLanes(const unsigned char *channels) {
+    __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(channels));
+    lanes = _mm_shufflelo_epi16(lanes, _MM_SHUFFLE(0, 1, 2, 3));
+    lanes = _mm_shufflehi_epi16(lanes, _MM_SHUFFLE(0, 1, 2, 3));
+    lanes = _mm_or_si128(_mm_slli_epi16(lanes, 8), _mm_srli_epi16(lanes, 8));
+    return _mm_movemask_epi8(_mm_slli_epi16(lanes, 7));
+}
+#endif
+
+size_t packLsbBytes(const unsigned char *channels, size_t byteCount, unsigned char *out) {
+    size_t i = 0;
+
+#ifdef STEGO_LSB_SSE2
+    // 16 bytes (128 channels) per step
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= byteCount; i += 16, channels += 128) {
+        const __m128i packed = _mm_setr_epi16((short)packLanes(channels), (short)packLanes(channels + 16),
+                                              (short)packLanes(channels + 32), (short)packLanes(channels + 48),
+                                              (short)packLanes(channels + 64), (short)packLanes(channels + 80),
+                                              (short)packLanes(channels + 96), (short)packLanes(channels + 112));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+
+        const int terminators = _mm_movemask_epi8(_mm_cmpeq_epi8(packed, zero));
+        if (terminators != 0) {
+            int lane = 0;
+            while (!((terminators >> lane) & 1)) lane++;
+            return i + lane;
+        }
+    }
+#endif
+
+    for (; i < byteCount; i++, channels += 8) {
+        unsigned char value = 0;
+        for (int k = 0; k < 8; k++) {
+            value = (unsigned char)((value << 1) | (channels[k] & 0x01));
+        }
+        if (value == 0) {
+            return i;
+        }
+        out[i] = value;
+    }
+    return byteCount;
+}
+
+bool PixelLsbReader::readBit(unsigned char channel) {
+    character = (unsigned char)((character << 1) | (channel & 0x01));
+    if (++bitCount == 8) {
+        if (character == 0) {
+            done = true;
+            return false;
+        }
+        text += (char)character;
+        character = 0;
+        bitCount = 0;
+    }
+    return true;
+}
+
+bool PixelLsbReader::readPixels(const color *pixels, int count) {
+    if (done) {
+        return false;
+    }
+
+    const unsigned char *channels = reinterpret_cast<const unsigned char*>(pixels);
+    const size_t channelCount = (size_t)count * 3;
+    size_t i = 0;
+
+    // Finishing the character the previous run ended in
+    for (; i < channelCount && bitCount != 0; i++) {
+        if (!readBit(channels[i])) return false;
+    }
+
+    // Whole characters, packed straight into the message
+    const size_t byteCount = (channelCount - i) / 8;
+    if (byteCount > 0) {
+        const size_t start = text.size();
+        text.resize(start + byteCount);
+
+        const size_t length = packLsbBytes(channels + i, byteCount, reinterpret_cast<unsigned char*>(&text[start]));
+        if (length < byteCount) {
+            text.resize(start + length);
+            done = true;
+            return false;
+        }
+        i += byteCount * 8;
+    }
+
+    // Start of the next character (fewer than 8 bits left)
+    for (; i < channelCount; i++) {
+        readBit(channels[i]);
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "StegoLib.h"
+
+// LSB embedding in pixel channels
+// A payload is a sequence of bits, most significant bit of each byte first; bit i goes to the least
+// significant bit of channel byte i, channels taken r, g, b per pixel in raster order. Messages are
+// embedded as their characters followed by a null character (8 zero bits)
+
+// embedLsbBits()
+// Description: Sets the LSBs of count consecutive channel bytes to payload bits [firstBit,
+//              firstBit + count). Works a payload byte (8 channels) or two (16 channels, SSE2) at a
+//              time once firstBit + i reaches a byte boundary
+// Input: unsigned char *channels - channel bytes to modify
+//        size_t count - number of channel bytes
+//        const unsigned char *payload - payload bits, at least (firstBit + count + 7) / 8 bytes
+//        uint64_t firstBit - payload bit going to channels[0]
+// Output: No return value, modifies the channel bytes
+void embedLsbBits(unsigned char *channels, size_t count, const unsigned char *payload, uint64_t firstBit);
+
+// embedLsbPayload()
+// Description: Embeds bitCount payload bits into the channels of an interleaved buffer, row after
+//              row; only the rows the payload covers are touched
+// Input: PixelBuffer<color> &pixels - pixels to modify
+//        const unsigned char *payload - payload bits
+//        uint64_t bitCount - number of bits to embed (at most 3 channels per pixel)
+// Output: No return value, modifies the pixels
+void embedLsbPayload(PixelBuffer<color> &pixels, const unsigned char *payload, uint64_t bitCount);
+
+// lsbCapacity()
+// Description: Number of payload bits an image of width x height pixels holds
+inline uint64_t lsbCapacity(uint64_t width, uint64_t height) {
+    return width * height * 3;
+}
+
+// embedLsbMessage()
+// Description: Embeds a message and its null terminator
+// Input: PixelBuffer<color> &pixels - pixels to modify
+//        const string &message - message to embed
+// Output: bool - false (nothing embedded) if the message and terminator do not fit
+bool embedLsbMessage(PixelBuffer<color> &pixels, const std::string &message);
+
+// packLsbBytes()
+// Description: Packs the LSBs of 8 * byteCount channel bytes into payload bytes, stopping at the
+//              first null byte (the message terminator). Works 128 channels (16 bytes) at a time with
+//              SSE2, the terminator found with a vector compare of the packed bytes
+// Input: const unsigned char *channels - channel bytes, 8 per payload byte
+//        size_t byteCount - number of payload bytes to pack
+//        unsigned char *out - receives the payload bytes, room for byteCount bytes (bytes after the
+//                             terminator may be written as well)
+// Output: size_t - number of bytes before the terminator, byteCount if there is none
+size_t packLsbBytes(const unsigned char *channels, size_t byteCount, unsigned char *out);
+
+// PixelLsbReader
+// Collects a message hidden in the LSBs of the r, g and b channels of pixels, fed in raster order a
+// row (or any run of pixels) at a time, until the null terminator
+class PixelLsbReader {
+public:
+    // readPixels()
+    // Description: Reads the bits of count pixels, whole characters through packLsbBytes() into room
+    //              added to the message for this run only (trimmed back at the terminator)
+    // Output: bool - false once the terminator has been read
+    bool readPixels(const color *pixels, int count);
+
+    bool finished() const { return done; }
+    const std::string& message() const { return text; }
+
+private:
+    // Adds a bit to the character being read, false if that completes the terminator
+    bool readBit(unsigned char channel);
+
+    std::string text;
+    unsigned char character = 0;
+    int bitCount = 0;
+    bool done = false;
+};
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int workerCount) {
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    available.notify_all();
+
+    for (thread &worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(max(1, int(thread::hardware_concurrency())) - 1);
+    return pool;
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) return;
+            task = move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int threads, const function<void(int, int)> &body) {
+    const int count = end - begin;
+    const int chunks = min({threads, count, concurrency()});
+
+    if (chunks <= 1) {
+        if (count > 0) body(begin, end);
+        return;
+    }
+
+    // Chunks are claimed through a shared counter by the caller and by the queued helpers, so
+    // helpers that start late simply find nothing left to do
+    struct Job {
+        atomic<int> next{0};
+        int remaining;
+        mutex doneMutex;
+        condition_variable done;
+    };
+    shared_ptr<Job> job = make_shared<Job>();
+    job->remaining = chunks;
+
+    auto runChunks = [job, begin, count, chunks, &body]() {
+        int chunk;
+        while ((chunk = job->next.fetch_add(1)) < chunks) {
+            const int first = begin + int((long long)count * chunk / chunks);
+            const int last = begin + int((long long)count * (chunk + 1) / chunks);
+            body(first, last);
+
+            lock_guard<mutex> lock(job->doneMutex);
+            if (--job->remaining == 0) job->done.notify_all();
+        }
+    };
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        for (int i = 1; i < chunks; i++) {
+            tasks.push(runChunks);
+        }
+    }
+    available.notify_all();
+
+    runChunks();
+
+    // body is only referenced while chunks remain, so waiting for them keeps it alive long enough
+    unique_lock<mutex> lock(job->doneMutex);
+    job->done.wait(lock, [&job] { return job->remaining == 0; });
+}
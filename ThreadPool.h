@@ -0,0 +1,45 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// ThreadPool
+// Fixed set of worker threads running range-splitting jobs. The calling thread of parallelFor()
+// works on its own job too, so a job always finishes even when every worker is busy with other
+// callers (e.g. concurrent server requests sharing the pool).
+class ThreadPool {
+public:
+    explicit ThreadPool(int workerCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Process-wide pool with one worker per hardware thread besides the caller
+    static ThreadPool& shared();
+
+    // Number of threads available to a job (workers plus the calling thread)
+    int concurrency() const { return int(workers.size()) + 1; }
+
+    // parallelFor()
+    // Description: Splits [begin, end) into at most threads contiguous chunks and runs body on each,
+    //              returning once every chunk is done. Chunk boundaries only depend on the range and
+    //              the thread count, so each index is always processed by exactly one body call
+    // Input: int begin, int end - range of indices (e.g. block rows)
+    //        int threads - maximum number of threads to use, 1 runs body(begin, end) inline
+    //        const function<void(int, int)> &body - processes the indices [first, last)
+    // Output: No return value
+    void parallelFor(int begin, int end, int threads, const std::function<void(int, int)> &body);
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable available;
+    bool stopping = false;
+};